@@ -0,0 +1,766 @@
+#ifndef MY_BUTTONS_MYB_ADC_HPP
+#define MY_BUTTONS_MYB_ADC_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <myb/myb.hpp>
+
+namespace myb {
+
+/// Number of bits in an ADC sample. The RP2040 ADC delivers 12 bit samples
+/// in the low bits of 16 bit FIFO words.
+inline constexpr unsigned adc_sample_bits = 12;
+
+/// Sum of the samples in word-packed form: each word holds two 16 bit
+/// samples, the earlier one in the low half, as a DMA transfer of 16 bit
+/// samples into a word buffer leaves them. Both halves are summed with one
+/// addition per word, and the lanes are folded before they can overflow.
+template <unsigned sample_bits = adc_sample_bits>
+  requires(sample_bits <= 15)
+constexpr std::uint32_t
+sum_packed_samples(std::span<std::uint32_t const> words) {
+  constexpr std::size_t words_per_fold = 0xffffu / ((1u << sample_bits) - 1);
+  std::uint32_t total{};
+  for (std::size_t i = 0; i < words.size();) {
+    auto const end = std::min(words.size(), i + words_per_fold);
+    std::uint32_t lanes{};
+    for (; i < end; ++i) {
+      lanes += words[i];
+    }
+    total += (lanes & 0xffffu) + (lanes >> 16);
+  }
+  return total;
+}
+
+// Filter stages work on std::int32_t samples. push(x, next) takes one
+// sample and passes what it produces, if anything, on to next.
+
+/// Decimating boxcar: the mean of each block of `length` samples.
+template <std::size_t length>
+  requires(length > 0 && length <= (std::size_t{1} << 16))
+class boxcar {
+  std::int32_t sum_{};
+  std::size_t count_{};
+
+public:
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push(std::int32_t x, Next &&next) {
+    sum_ += x;
+    if (++count_ == length) {
+      next(sum_ / static_cast<std::int32_t>(length));
+      sum_ = 0;
+      count_ = 0;
+    }
+  }
+  /// Whole blocks of samples are reduced with sum_packed_samples.
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push_packed(std::span<std::uint32_t const> words,
+                             Next &&next) {
+    while (!words.empty() && count_ != 0) {
+      auto const w = words.front();
+      words = words.subspan(1);
+      push(static_cast<std::int32_t>(w & 0xffffu), next);
+      push(static_cast<std::int32_t>(w >> 16), next);
+    }
+    if constexpr (length % 2 == 0) {
+      constexpr auto block_words = length / 2;
+      for (; words.size() >= block_words; words = words.subspan(block_words)) {
+        auto const sum = sum_packed_samples(words.first(block_words));
+        next(static_cast<std::int32_t>(sum / length));
+      }
+    }
+    for (auto w : words) {
+      push(static_cast<std::int32_t>(w & 0xffffu), next);
+      push(static_cast<std::int32_t>(w >> 16), next);
+    }
+  }
+};
+
+/// Exponential moving average with a smoothing factor of 2^-shift. The
+/// state keeps `shift` fractional bits so that small steps are not lost.
+template <unsigned shift>
+  requires(shift < 16)
+class ema {
+  std::int32_t state_{};
+  bool primed_{};
+
+public:
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push(std::int32_t x, Next &&next) {
+    if (!primed_) {
+      state_ = x * (std::int32_t{1} << shift);
+      primed_ = true;
+    } else {
+      state_ += x - (state_ >> shift);
+    }
+    next(state_ >> shift);
+  }
+};
+
+/// Median of the last `length` samples, starting once that many are in. A
+/// sorted copy of the window is kept up to date by moving the replaced
+/// sample to the new one's place, so each sample costs O(length).
+template <std::size_t length>
+  requires(length % 2 == 1)
+class median {
+  std::array<std::int32_t, length> window_{};
+  std::array<std::int32_t, length> sorted_{};
+  std::size_t next_{};
+  std::size_t count_{};
+
+public:
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push(std::int32_t x, Next &&next) {
+    auto const old = std::exchange(window_[next_], x);
+    next_ = next_ + 1 == length ? 0 : next_ + 1;
+    auto i = count_ < length ? count_++
+                             : static_cast<std::size_t>(
+                                   std::ranges::find(sorted_, old) -
+                                   sorted_.begin());
+    for (; i > 0 && sorted_[i - 1] > x; --i) {
+      sorted_[i] = sorted_[i - 1];
+    }
+    for (; i + 1 < count_ && sorted_[i + 1] < x; ++i) {
+      sorted_[i] = sorted_[i + 1];
+    }
+    sorted_[i] = x;
+    if (count_ == length) {
+      next(sorted_[length / 2]);
+    }
+  }
+};
+
+/// Cascaded integrator-comb decimator with `order` stages and a differential
+/// delay of one. The integrators wrap, which the combs undo, and the output
+/// is scaled back by the gain ratio^order.
+template <std::size_t ratio, std::size_t order>
+  requires(ratio > 1 && order > 0)
+class cic {
+  static constexpr std::uint64_t gain = [] {
+    std::uint64_t g = 1;
+    for (std::size_t i = 0; i < order; ++i) {
+      g *= ratio;
+    }
+    return g;
+  }();
+  static_assert((gain << adc_sample_bits) <=
+                    std::numeric_limits<std::int32_t>::max(),
+                "Output of the combs does not fit in 32 bits");
+  std::array<std::uint32_t, order> integrators_{};
+  std::array<std::uint32_t, order> combs_{};
+  std::size_t count_{};
+
+public:
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push(std::int32_t x, Next &&next) {
+    auto acc = static_cast<std::uint32_t>(x);
+    for (auto &i : integrators_) {
+      i += acc;
+      acc = i;
+    }
+    if (++count_ != ratio) {
+      return;
+    }
+    count_ = 0;
+    for (auto &c : combs_) {
+      auto const prev = std::exchange(c, acc);
+      acc -= prev;
+    }
+    if constexpr (std::has_single_bit(gain)) {
+      next(static_cast<std::int32_t>(acc >> std::countr_zero(gain)));
+    } else {
+      next(static_cast<std::int32_t>(acc / static_cast<std::uint32_t>(gain)));
+    }
+  }
+};
+
+/// FIR filter with compile time coefficients in fixed point: the output is
+/// sum(coeffs[k] * x[n - k]) >> shift. Samples before the first count as
+/// zero.
+template <std::array coeffs, unsigned shift>
+  requires(std::same_as<typename decltype(coeffs)::value_type, std::int32_t> &&
+           coeffs.size() > 0)
+class fir {
+  static constexpr auto taps = coeffs.size();
+  std::array<std::int32_t, taps> history_{};
+  std::size_t next_{};
+
+public:
+  template <std::invocable<std::int32_t> Next>
+  constexpr void push(std::int32_t x, Next &&next) {
+    history_[next_] = x;
+    std::int32_t acc{};
+    auto h = next_;
+    for (std::size_t k = 0; k < taps; ++k) {
+      acc += coeffs[k] * history_[h];
+      h = h == 0 ? taps - 1 : h - 1;
+    }
+    next_ = next_ + 1 == taps ? 0 : next_ + 1;
+    next(acc >> shift);
+  }
+};
+
+template <typename T>
+concept filter_stage =
+    requires(T &t, std::int32_t x, void (*next)(std::int32_t)) {
+      t.push(x, next);
+    };
+
+/// Chain of filter stages run over each completed ADC buffer. The first
+/// stage gets the buffer in word-packed form if it has push_packed, and one
+/// sample at a time otherwise.
+template <filter_stage... Stages>
+  requires(sizeof...(Stages) > 0)
+class adc_pipeline {
+  std::tuple<Stages...> stages_;
+  std::int32_t value_{};
+  std::uint32_t outputs_{};
+
+  template <std::size_t i> constexpr void push_from(std::int32_t x) {
+    if constexpr (i == sizeof...(Stages)) {
+      value_ = x;
+      ++outputs_;
+    } else {
+      std::get<i>(stages_).push(x, [this](std::int32_t y) {
+        push_from<i + 1>(y);
+      });
+    }
+  }
+  constexpr std::optional<std::int32_t>
+  latest_since(std::uint32_t outputs) const {
+    if (outputs == outputs_) {
+      return std::nullopt;
+    }
+    return value_;
+  }
+
+public:
+  constexpr adc_pipeline() = default;
+  constexpr explicit adc_pipeline(Stages... stages)
+      : stages_(std::move(stages)...) {}
+
+  constexpr void push(std::int32_t x) { push_from<0>(x); }
+  /// Runs a buffer of word-packed samples, see sum_packed_samples. Returns
+  /// the latest output if the buffer produced any.
+  constexpr std::optional<std::int32_t>
+  run(std::span<std::uint32_t const> words) {
+    auto const before = outputs_;
+    using first_t = std::tuple_element_t<0, std::tuple<Stages...>>;
+    if constexpr (requires(first_t &f) {
+                    f.push_packed(words, [](std::int32_t) {});
+                  }) {
+      std::get<0>(stages_).push_packed(
+          words, [this](std::int32_t y) { push_from<1>(y); });
+    } else {
+      for (auto w : words) {
+        push(static_cast<std::int32_t>(w & 0xffffu));
+        push(static_cast<std::int32_t>(w >> 16));
+      }
+    }
+    return latest_since(before);
+  }
+  constexpr std::optional<std::int32_t>
+  run(std::span<std::uint16_t const> samples) {
+    auto const before = outputs_;
+    for (auto s : samples) {
+      push(s);
+    }
+    return latest_since(before);
+  }
+  /// Runs one sample, such as a block mean from the DMA sniffer.
+  constexpr std::optional<std::int32_t> run(std::int32_t x) {
+    auto const before = outputs_;
+    push(x);
+    return latest_since(before);
+  }
+  /// The latest output, and how many there have been.
+  constexpr std::int32_t value() const noexcept { return value_; }
+  constexpr std::uint32_t outputs() const noexcept { return outputs_; }
+};
+template <typename... Stages>
+adc_pipeline(Stages...) -> adc_pipeline<Stages...>;
+
+/// What running a word-packed block through Pipeline returns.
+template <typename Pipeline>
+using adc_run_result_t = decltype(std::declval<Pipeline &>().run(
+    std::declval<std::span<std::uint32_t const>>()));
+
+/// Where the samples of a block are summed.
+enum class adc_averaging {
+  /// The CPU sums the buffer in the DMA IRQ, see sum_packed_samples.
+  cpu,
+  /// The DMA sniffer sums the samples while they are transferred, and the
+  /// samples themselves are not kept.
+  sniffer,
+};
+
+/// The DMA channel behind adc_dma_capture. start_packed starts 16 bit
+/// transfers from the ADC FIFO into the words, two samples per word.
+/// start_sniffed starts full word transfers into a scratch word with the
+/// sniffer summing them from zero, and sniffed_sum reads that sum. ack
+/// clears the channel's interrupt, and abort stops a running transfer and
+/// clears it too.
+template <typename T>
+concept adc_dma_hal = requires(T &hal, std::span<std::uint32_t> words,
+                               std::uint32_t transfers) {
+  hal.start_packed(words);
+  hal.start_sniffed(transfers);
+  { hal.sniffed_sum() } -> std::convertible_to<std::uint32_t>;
+  hal.ack();
+  hal.abort();
+};
+
+/// Continuous capture of ADC blocks of block_size samples by DMA. take() is
+/// called from the DMA interrupt: it starts the next block and feeds the
+/// completed one to a pipeline. With adc_averaging::sniffer the pipeline gets
+/// the block mean only, so it should not start with a boxcar.
+template <adc_dma_hal Hal, std::size_t block_size,
+          adc_averaging mode = adc_averaging::cpu>
+  requires(block_size % 2 == 0)
+class adc_dma_capture {
+  static constexpr std::size_t block_words = block_size / 2;
+  static constexpr bool buffered = mode == adc_averaging::cpu;
+  struct no_buffers {};
+  using buffers_t =
+      std::conditional_t<buffered, std::array<std::uint32_t, 2 * block_words>,
+                         no_buffers>;
+  [[no_unique_address]] Hal hal_;
+  [[no_unique_address]] buffers_t buffers_{};
+  std::size_t write_half_{};
+
+  constexpr std::span<std::uint32_t, block_words> half(std::size_t i) {
+    return std::span<std::uint32_t, block_words>(
+        buffers_.data() + i * block_words, block_words);
+  }
+
+public:
+  static constexpr adc_averaging averaging = mode;
+
+  adc_dma_capture() = default;
+  constexpr explicit adc_dma_capture(Hal hal) : hal_(std::move(hal)) {}
+  adc_dma_capture(adc_dma_capture const &) = delete;
+  adc_dma_capture &operator=(adc_dma_capture const &) = delete;
+
+  constexpr Hal &hal() noexcept { return hal_; }
+  constexpr void start() {
+    if constexpr (buffered) {
+      hal_.start_packed(half(write_half_));
+    } else {
+      hal_.start_sniffed(block_size);
+    }
+  }
+  /// Returns what the pipeline's run returns for the block.
+  template <typename Pipeline> constexpr auto take(Pipeline &p) {
+    if constexpr (buffered) {
+      auto const done = write_half_;
+      write_half_ ^= 1;
+      start();
+      hal_.ack();
+      return p.run(std::span<std::uint32_t const>(half(done)));
+    } else {
+      std::uint32_t const sum = hal_.sniffed_sum();
+      start();
+      hal_.ack();
+      return p.run(static_cast<std::int32_t>(sum / block_size));
+    }
+  }
+};
+
+/// How adc_chained_capture keeps the DMA running between blocks.
+enum class adc_chaining {
+  /// Two channels, one per half of the buffer, chained to each other
+  /// through control channels that move each one back to the start of its
+  /// half. The interrupt does not touch the DMA at all.
+  ping_pong,
+  /// One channel whose write address wraps around the whole buffer,
+  /// retriggered after each block by a control channel. The interrupt does
+  /// not touch the DMA at all.
+  ring,
+};
+
+/// The DMA channels behind adc_chained_capture. For ping_pong, start_ping_pong
+/// starts the first of two chained channels doing 16 bit transfers into the
+/// halves. A channel must be back at the start of its half before the chain
+/// triggers it again, so that it never writes outside it. For ring,
+/// start_ring starts 16 bit transfers of `block` samples at a time into the
+/// wrapping buffer, and ring_position is the sample index the next transfer
+/// goes to. take_completed returns and clears the channels, as bits, whose
+/// completion interrupt is pending, and take_fifo_overflow the sticky ADC
+/// FIFO overflow flag.
+template <typename T>
+concept chained_adc_dma_hal =
+    requires(T &hal, std::span<std::uint32_t> words, std::uint32_t block) {
+      hal.start_ping_pong(words, words);
+      hal.start_ring(words, block);
+      { hal.take_completed() } -> std::convertible_to<std::uint32_t>;
+      { hal.ring_position() } -> std::convertible_to<std::size_t>;
+      { hal.take_fifo_overflow() } -> std::convertible_to<bool>;
+      hal.abort();
+    };
+
+/// Continuous capture of ADC blocks of block_size samples into the two
+/// halves of a buffer, with the DMA running on its own between blocks. take()
+/// is called from the DMA interrupt and feeds each finished half to a
+/// pipeline. If the interrupt comes too late, the overwritten samples are
+/// dropped and counted instead.
+template <chained_adc_dma_hal Hal, std::size_t block_size,
+          adc_chaining chaining = adc_chaining::ping_pong>
+  requires(block_size % 2 == 0 &&
+           (chaining == adc_chaining::ping_pong ||
+            (std::has_single_bit(block_size) && block_size <= 8192)))
+class adc_chained_capture {
+  static constexpr std::size_t block_words = block_size / 2;
+  // The write ring wraps on the buffer size, so it must be aligned to it.
+  static constexpr std::size_t buffer_align =
+      chaining == adc_chaining::ring ? 2 * block_words * 4
+                                     : alignof(std::uint32_t);
+  [[no_unique_address]] Hal hal_;
+  alignas(buffer_align) std::array<std::uint32_t, 2 * block_words> buffers_{};
+  std::size_t next_half_{};
+  std::uint32_t overruns_{};
+  std::uint32_t dropped_samples_{};
+  std::uint32_t fifo_overflows_{};
+
+  constexpr std::span<std::uint32_t, block_words> half(std::size_t i) {
+    return std::span<std::uint32_t, block_words>(
+        buffers_.data() + i * block_words, block_words);
+  }
+  template <typename Pipeline>
+  constexpr adc_run_result_t<Pipeline> run(Pipeline &p, std::size_t h) {
+    return p.run(std::span<std::uint32_t const>(half(h)));
+  }
+
+public:
+  static constexpr adc_averaging averaging = adc_averaging::cpu;
+
+  adc_chained_capture() = default;
+  constexpr explicit adc_chained_capture(Hal hal) : hal_(std::move(hal)) {}
+  adc_chained_capture(adc_chained_capture const &) = delete;
+  adc_chained_capture &operator=(adc_chained_capture const &) = delete;
+
+  constexpr Hal &hal() noexcept { return hal_; }
+  constexpr void start() {
+    next_half_ = 0;
+    if constexpr (chaining == adc_chaining::ping_pong) {
+      hal_.start_ping_pong(half(0), half(1));
+    } else {
+      hal_.start_ring(buffers_, block_size);
+    }
+  }
+  /// Returns what the pipeline's run returns for the completed block, or
+  /// an empty result if there is none.
+  template <typename Pipeline>
+  constexpr adc_run_result_t<Pipeline> take(Pipeline &p) {
+    if (hal_.take_fifo_overflow()) {
+      ++fifo_overflows_;
+    }
+    std::uint32_t const done = hal_.take_completed();
+    if (done == 0) {
+      return {};
+    }
+    if constexpr (chaining == adc_chaining::ping_pong) {
+      auto const h = next_half_;
+      if (done != (1u << h)) {
+        // Both halves finished since the last interrupt, and the chain is
+        // writing this half again. Which one is whole is not known, so start
+        // over.
+        hal_.abort();
+        ++overruns_;
+        dropped_samples_ += 2 * block_size;
+        start();
+        return {};
+      }
+      next_half_ ^= 1;
+      return run(p, h);
+    } else {
+      // Completions can merge into one interrupt, so the half to read is
+      // the one the DMA is not writing, whichever was due.
+      auto const writing = hal_.ring_position() / block_size;
+      auto const ready = writing ^ 1;
+      if (ready != next_half_) {
+        ++overruns_;
+        dropped_samples_ += block_size;
+      }
+      next_half_ = writing;
+      return run(p, ready);
+    }
+  }
+
+  /// Interrupts that came too late, the samples they lost, and the times
+  /// the ADC FIFO overflowed because no transfer was running.
+  constexpr std::uint32_t overruns() const noexcept { return overruns_; }
+  constexpr std::uint32_t dropped_samples() const noexcept {
+    return dropped_samples_;
+  }
+  constexpr std::uint32_t fifo_overflows() const noexcept {
+    return fifo_overflows_;
+  }
+};
+
+/// ADC inputs sampled round-robin into one DMA stream. The RP2040 ADC
+/// steps through the enabled inputs in ascending order, starting from the
+/// selected one, so the list must be ascending. Input 4 is the temperature
+/// sensor.
+template <unsigned... inputs>
+  requires(sizeof...(inputs) > 0 && ((inputs < 5) && ...))
+struct adc_channel_list {
+  static constexpr std::size_t size = sizeof...(inputs);
+  static constexpr std::array<unsigned, size> list = {inputs...};
+  static_assert(std::ranges::is_sorted(list) &&
+                    std::ranges::adjacent_find(list) == list.end(),
+                "ADC inputs must be ascending");
+  static constexpr unsigned first = list[0];
+  static constexpr std::uint32_t round_robin_mask = ((1u << inputs) | ...);
+  static constexpr bool has_temperature = ((inputs == 4) || ...);
+
+  /// Position of ADC input `input` in the stream.
+  template <unsigned input>
+    requires(((input == inputs) || ...))
+  static constexpr std::size_t index_of =
+      static_cast<std::size_t>(std::ranges::find(list, input) - list.begin());
+};
+
+/// Splits a word-packed block of `channels` interleaved channels into one
+/// word-packed buffer per channel, in a single pass over the block. Every
+/// `channels` words hold two samples of each channel, which make up one
+/// word of each output.
+template <std::size_t channels, std::size_t words_per_channel>
+constexpr void deinterleave_packed(
+    std::span<std::uint32_t const, channels * words_per_channel> words,
+    std::array<std::array<std::uint32_t, words_per_channel>, channels> &out) {
+  auto sample = [](std::span<std::uint32_t const, channels> frame,
+                   std::size_t k) {
+    return (frame[k / 2] >> (16 * (k % 2))) & 0xffffu;
+  };
+  for (std::size_t w = 0; w < words_per_channel; ++w) {
+    auto const frame = words.subspan(w * channels).template first<channels>();
+    [&]<std::size_t... cs>(std::index_sequence<cs...>) {
+      ((out[cs][w] = sample(frame, cs) | (sample(frame, channels + cs) << 16)),
+       ...);
+    }(std::make_index_sequence<channels>{});
+  }
+}
+
+/// Runs a copy of Pipeline per channel over blocks of `per_channel` round
+/// robin samples per channel. Stands in for a pipeline in the capture
+/// classes, and needs one that does not drop samples, see
+/// adc_chained_capture: a lost sample would shift the channels.
+template <typename Channels, std::size_t per_channel, typename Pipeline>
+  requires(per_channel % 2 == 0)
+class adc_channels {
+  static constexpr auto n = Channels::size;
+  static constexpr auto words_per_channel = per_channel / 2;
+  std::array<std::array<std::uint32_t, words_per_channel>, n> split_{};
+  std::array<Pipeline, n> pipelines_;
+
+public:
+  using values_type = std::array<std::int32_t, n>;
+  static constexpr std::size_t block_size = n * per_channel;
+
+  constexpr explicit adc_channels(Pipeline const &p)
+      : pipelines_([&p]<std::size_t... is>(std::index_sequence<is...>) {
+          return std::array<Pipeline, n>{((void)is, p)...};
+        }(std::make_index_sequence<n>{})) {}
+
+  /// Returns the latest value of every channel if any of them got a new
+  /// one.
+  constexpr std::optional<values_type>
+  run(std::span<std::uint32_t const> words) {
+    always_assert(words.size() == n * words_per_channel);
+    deinterleave_packed<n, words_per_channel>(
+        words.template first<n * words_per_channel>(), split_);
+    bool any{};
+    for (std::size_t c = 0; c < n; ++c) {
+      any |= pipelines_[c]
+                 .run(std::span<std::uint32_t const>(split_[c]))
+                 .has_value();
+    }
+    if (!any) {
+      return std::nullopt;
+    }
+    return values();
+  }
+  constexpr values_type values() const {
+    values_type res{};
+    for (std::size_t c = 0; c < n; ++c) {
+      res[c] = pipelines_[c].value();
+    }
+    return res;
+  }
+  template <unsigned input> constexpr Pipeline const &channel() const {
+    return pipelines_[Channels::template index_of<input>];
+  }
+};
+
+/// Temperature of the RP2040 die in millidegrees Celsius from a reading of
+/// ADC input 4, per the datasheet: 27 degrees at 0.706 V, falling 1.721 mV
+/// per degree, with a 3.3 V reference.
+constexpr std::int32_t adc_temperature_millicelsius(std::int32_t raw) {
+  auto const microvolts = std::int64_t{raw} * 3'300'000 / 4096;
+  return static_cast<std::int32_t>(27'000 -
+                                   (microvolts - 706'000) * 1000 / 1721);
+}
+
+/// What adc_change_detector made of a value.
+struct adc_change {
+  /// Moved out of the deadband around the last output, which it now is.
+  bool update{};
+  /// Stayed out of the activity band for the dwell time: the user moved
+  /// the input, and sleep should be postponed.
+  bool activity{};
+};
+
+/// Change detection for filtered ADC values with two outputs. The output
+/// follows the value once it moves more than `deadband` away, which is what
+/// a PWM level should track. Activity is only reported when the value has
+/// stayed more than `deadband + hysteresis` away from an anchor for at least
+/// `min_dwell`, so that noise does not keep the device awake. While the
+/// value stays inside that band, the anchor follows it by one step per
+/// `drift_step`, so that drift slower than that does not either, however
+/// often values are pushed.
+template <typename TimePoint> class adc_change_detector {
+  using duration = typename TimePoint::duration;
+  std::int32_t deadband_;
+  std::int32_t hysteresis_;
+  duration min_dwell_;
+  duration drift_step_;
+  std::int32_t output_{};
+  std::int32_t anchor_{};
+  TimePoint drifted_at_{};
+  std::optional<TimePoint> out_since_{};
+  bool primed_{};
+  std::uint32_t activities_{};
+  std::uint32_t suppressed_{};
+
+  constexpr void follow_drift(std::int32_t v, TimePoint const &tp) {
+    auto const steps = (tp - drifted_at_) / drift_step_;
+    drifted_at_ += steps * drift_step_;
+    auto const step = static_cast<std::int32_t>(
+        std::min<decltype(steps)>(steps, std::abs(v - anchor_)));
+    anchor_ += v < anchor_ ? -step : step;
+  }
+
+public:
+  constexpr adc_change_detector(std::int32_t deadband, std::int32_t hysteresis,
+                                duration min_dwell, duration drift_step)
+      : deadband_(deadband), hysteresis_(hysteresis), min_dwell_(min_dwell),
+        drift_step_(drift_step) {}
+
+  constexpr adc_change push(std::int32_t v, TimePoint const &tp) {
+    if (!std::exchange(primed_, true)) {
+      output_ = v;
+      anchor_ = v;
+      drifted_at_ = tp;
+      return {.update = true};
+    }
+    auto res = adc_change{};
+    if (std::abs(v - output_) > deadband_) {
+      output_ = v;
+      res.update = true;
+    }
+    auto const excursion = std::abs(v - anchor_);
+    if (excursion > deadband_ + hysteresis_) {
+      if (!out_since_) {
+        out_since_ = tp;
+      }
+      if (tp - *out_since_ >= min_dwell_) {
+        anchor_ = v;
+        drifted_at_ = tp;
+        out_since_.reset();
+        ++activities_;
+        res.activity = true;
+        return res;
+      }
+      // The anchor only follows drift from in the band, not from out here.
+      drifted_at_ = tp;
+    } else {
+      out_since_.reset();
+      follow_drift(v, tp);
+    }
+    if (excursion > deadband_) {
+      ++suppressed_;
+    }
+    return res;
+  }
+  constexpr std::int32_t output() const noexcept { return output_; }
+  /// Activity reported, and values out of the deadband around the last
+  /// activity that were not reported as one.
+  constexpr std::uint32_t activities() const noexcept { return activities_; }
+  constexpr std::uint32_t suppressed() const noexcept { return suppressed_; }
+};
+
+/// The ADC converts every 96 cycles of its 48 MHz clock at most.
+inline constexpr std::uint32_t adc_clock_hz = 48'000'000;
+inline constexpr std::uint32_t adc_conversion_cycles = 96;
+inline constexpr std::uint32_t adc_max_rate =
+    adc_clock_hz / adc_conversion_cycles;
+
+/// The divider for adc_set_clkdiv that gives `samples_per_second`: a
+/// conversion every 1 + div cycles, or back to back for 0.
+constexpr float adc_clkdiv(std::uint32_t samples_per_second) noexcept {
+  if (samples_per_second >= adc_max_rate) {
+    return 0.f;
+  }
+  return static_cast<float>(adc_clock_hz) /
+             static_cast<float>(samples_per_second) -
+         1.f;
+}
+
+enum class adc_rate : std::uint8_t { background, burst };
+
+/// Picks the ADC sample rate from what adc_change_detector makes of the
+/// filtered values. The ADC runs at the burst rate from any output update
+/// until it has been still for `burst_hold`, and at the background rate
+/// otherwise.
+template <typename TimePoint> class adc_rate_controller {
+  using duration = typename TimePoint::duration;
+  duration burst_hold_;
+  adc_rate rate_;
+  TimePoint moved_at_{};
+  std::uint32_t bursts_{};
+
+public:
+  constexpr explicit adc_rate_controller(duration burst_hold,
+                                         adc_rate initial = adc_rate::burst)
+      : burst_hold_(burst_hold), rate_(initial) {}
+
+  /// Restarts the hold at tp, as after a wakeup.
+  constexpr void restart(adc_rate r, TimePoint const &tp) noexcept {
+    rate_ = r;
+    moved_at_ = tp;
+  }
+  /// Returns the rate to switch to, if it changes.
+  constexpr std::optional<adc_rate> push(adc_change const &c,
+                                         TimePoint const &tp) noexcept {
+    if (c.update) {
+      moved_at_ = tp;
+      if (rate_ == adc_rate::background) {
+        ++bursts_;
+        return rate_ = adc_rate::burst;
+      }
+    } else if (rate_ == adc_rate::burst && tp - moved_at_ >= burst_hold_) {
+      return rate_ = adc_rate::background;
+    }
+    return std::nullopt;
+  }
+  constexpr adc_rate rate() const noexcept { return rate_; }
+  /// Switches from the background to the burst rate.
+  constexpr std::uint32_t bursts() const noexcept { return bursts_; }
+};
+
+} // namespace myb
+
+#endif
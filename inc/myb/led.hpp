@@ -0,0 +1,323 @@
+#ifndef MY_BUTTONS_MYB_LED_HPP
+#define MY_BUTTONS_MYB_LED_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include <myb/myb.hpp>
+
+namespace myb {
+
+/// Relative luminance, 0 to 1, of CIE 1931 lightness L*, 0 to 100.
+constexpr double cie_luminance(double lightness) noexcept {
+  if (lightness <= 8.) {
+    return lightness / 903.3;
+  }
+  auto const f = (lightness + 16.) / 116.;
+  return f * f * f;
+}
+
+/// PWM levels, 0 to top, for `steps` evenly spaced lightness steps. Equal
+/// steps in the table look like equal steps in brightness.
+template <std::size_t steps, std::uint16_t top>
+  requires(steps > 1)
+constexpr std::array<std::uint16_t, steps> cie_lut() noexcept {
+  auto lut = std::array<std::uint16_t, steps>{};
+  for (std::size_t i = 0; i < steps; ++i) {
+    auto const lightness =
+        100. * static_cast<double>(i) / static_cast<double>(steps - 1);
+    lut[i] = static_cast<std::uint16_t>(cie_luminance(lightness) * top + .5);
+  }
+  return lut;
+}
+
+/// Lightness steps of led_animator, one byte per channel.
+inline constexpr std::size_t led_lightness_steps = 256;
+
+/// Time-based patterns for channel_count PWM channels. Levels are given in
+/// lightness, 0 to 255, and go out through the lut as PWM levels to
+/// Out(channel, level), and only when they change. All channels are
+/// stepped together by step(), which returns when it needs to run next:
+/// never sooner than `tick` later, and not at all while every channel is
+/// steady.
+template <typename TimePoint, std::size_t channel_count, typename Out>
+  requires(std::invocable<Out &, std::size_t, std::uint16_t>)
+class led_animator {
+  using duration = typename TimePoint::duration;
+  enum class pattern : std::uint8_t { steady, fade, breathe, blink };
+  static constexpr std::uint32_t not_written = 0xffffffffu;
+  struct channel {
+    pattern p{};
+    std::uint8_t from{};
+    std::uint8_t to{};
+    TimePoint start{};
+    duration period{};
+    duration on{};
+    std::uint32_t written{not_written};
+  };
+  std::span<std::uint16_t const, led_lightness_steps> lut_;
+  duration tick_;
+  std::array<channel, channel_count> channels_{};
+  [[no_unique_address]] Out out_;
+  std::uint32_t steps_{};
+  std::uint32_t writes_{};
+
+  static constexpr std::uint8_t between(std::uint8_t from, std::uint8_t to,
+                                        duration part, duration whole) {
+    return static_cast<std::uint8_t>(from + (to - from) * part.count() /
+                                                whole.count());
+  }
+  constexpr channel &restart(std::size_t i, pattern p, TimePoint const &tp) {
+    auto &c = channels_[i];
+    c.p = p;
+    c.start = tp;
+    return c;
+  }
+  static constexpr std::optional<TimePoint> next_change(channel const &c,
+                                                        TimePoint const &tp,
+                                                        duration tick) {
+    switch (c.p) {
+    case pattern::steady:
+      return std::nullopt;
+    case pattern::fade:
+      return std::min(tp + tick, c.start + c.period);
+    case pattern::breathe:
+      return tp + tick;
+    case pattern::blink: {
+      auto const phase = (tp - c.start) % c.period;
+      return tp - phase + (phase < c.on ? c.on : c.period);
+    }
+    }
+    return std::nullopt;
+  }
+
+public:
+  constexpr led_animator(
+      std::span<std::uint16_t const, led_lightness_steps> lut, duration tick,
+      Out out = {})
+      : lut_(lut), tick_(tick), out_(std::move(out)) {}
+
+  constexpr void set(std::size_t i, std::uint8_t lightness) {
+    auto &c = restart(i, pattern::steady, {});
+    c.to = lightness;
+  }
+  /// Fades linearly in lightness from the current level to `lightness`.
+  constexpr void fade(std::size_t i, std::uint8_t lightness, duration d,
+                      TimePoint const &tp) {
+    auto const from = level(i, tp);
+    if (d <= duration::zero()) {
+      set(i, lightness);
+      return;
+    }
+    auto &c = restart(i, pattern::fade, tp);
+    c.from = from;
+    c.to = lightness;
+    c.period = d;
+  }
+  /// Goes from low up to high and back down once per period.
+  constexpr void breathe(std::size_t i, std::uint8_t low, std::uint8_t high,
+                         duration period, TimePoint const &tp) {
+    auto &c = restart(i, pattern::breathe, tp);
+    c.from = low;
+    c.to = high;
+    c.period = period;
+  }
+  /// At `lightness` for the first `on` of every period, off otherwise.
+  constexpr void blink(std::size_t i, std::uint8_t lightness, duration on,
+                       duration period, TimePoint const &tp) {
+    auto &c = restart(i, pattern::blink, tp);
+    c.from = 0;
+    c.to = lightness;
+    c.on = on;
+    c.period = period;
+  }
+
+  /// Lightness of channel i at tp.
+  constexpr std::uint8_t level(std::size_t i, TimePoint const &tp) const {
+    auto const &c = channels_[i];
+    auto const elapsed = std::max(tp - c.start, duration::zero());
+    switch (c.p) {
+    case pattern::steady:
+      return c.to;
+    case pattern::fade:
+      return elapsed >= c.period ? c.to
+                                 : between(c.from, c.to, elapsed, c.period);
+    case pattern::breathe: {
+      auto const phase = elapsed % c.period;
+      return between(c.from, c.to, 2 * std::min(phase, c.period - phase),
+                     c.period);
+    }
+    case pattern::blink:
+      return elapsed % c.period < c.on ? c.to : c.from;
+    }
+    return c.to;
+  }
+  constexpr std::uint16_t pwm_level(std::size_t i, TimePoint const &tp) const {
+    return lut_[level(i, tp)];
+  }
+
+  /// Writes the levels at tp that changed, and returns when to step next.
+  constexpr std::optional<TimePoint> step(TimePoint const &tp) {
+    ++steps_;
+    auto res = std::optional<TimePoint>{};
+    for (std::size_t i = 0; i < channel_count; ++i) {
+      auto &c = channels_[i];
+      auto const pwm = pwm_level(i, tp);
+      if (c.written != pwm) {
+        c.written = pwm;
+        ++writes_;
+        std::invoke(out_, i, pwm);
+      }
+      if (c.p == pattern::fade && tp >= c.start + c.period) {
+        c.p = pattern::steady;
+      }
+      if (auto n = next_change(c, tp, tick_); n && (!res || *n < *res)) {
+        res = n;
+      }
+    }
+    if (res) {
+      res = std::max(*res, tp + tick_);
+    }
+    return res;
+  }
+  /// Writes every level again on the next step, as after a wakeup.
+  constexpr void invalidate() noexcept {
+    for (auto &c : channels_) {
+      c.written = not_written;
+    }
+  }
+  constexpr std::uint32_t steps() const noexcept { return steps_; }
+  constexpr std::uint32_t writes() const noexcept { return writes_; }
+};
+
+/// A PWM slice compare register holds the level of channel A in its low and
+/// of channel B in its high half. Narrow writes to it are replicated over
+/// both halves, so a DMA transfer has to write the whole word, with the
+/// level of the other channel in it.
+constexpr std::uint32_t pwm_cc_word(unsigned channel, std::uint16_t level,
+                                    std::uint16_t other = 0) noexcept {
+  return channel == 0 ? level | (std::uint32_t{other} << 16)
+                      : other | (std::uint32_t{level} << 16);
+}
+
+/// Fills `words` with a fade from one lightness to another, linear in
+/// lightness and mapped through the lut, one word per PWM wrap.
+constexpr void
+pwm_fade_words(std::span<std::uint32_t> words,
+               std::span<std::uint16_t const, led_lightness_steps> lut,
+               std::uint8_t from, std::uint8_t to, unsigned channel,
+               std::uint16_t other = 0) {
+  auto const n = static_cast<std::int32_t>(words.size());
+  for (std::int32_t i = 0; i < n; ++i) {
+    auto const l = from + (to - from) * (i + 1) / n;
+    words[static_cast<std::size_t>(i)] = pwm_cc_word(channel, lut[l], other);
+  }
+}
+
+/// sin(x) for constant expressions, to about 1e-6.
+constexpr double constexpr_sin(double x) noexcept {
+  constexpr double pi = 3.14159265358979323846;
+  x -= 2 * pi * static_cast<double>(static_cast<std::int64_t>(x / (2 * pi)));
+  if (x > pi) {
+    x -= 2 * pi;
+  } else if (x < -pi) {
+    x += 2 * pi;
+  }
+  if (x > pi / 2) {
+    x = pi - x;
+  } else if (x < -pi / 2) {
+    x = -pi - x;
+  }
+  auto const x2 = x * x;
+  auto term = x;
+  auto res = x;
+  for (int k = 1; k < 7; ++k) {
+    term *= -x2 / ((2 * k) * (2 * k + 1));
+    res += term;
+  }
+  return res;
+}
+
+/// One period of a sine between 0 and top as compare words, for tones
+/// played by looping it at the PWM wrap rate: wrap rate / n Hz.
+template <std::size_t n>
+constexpr std::array<std::uint32_t, n> pwm_sine_words(std::uint16_t top,
+                                                      unsigned channel) {
+  auto words = std::array<std::uint32_t, n>{};
+  for (std::size_t i = 0; i < n; ++i) {
+    auto const phase = 2 * 3.14159265358979323846 * static_cast<double>(i) /
+                       static_cast<double>(n);
+    auto const level = (1. + constexpr_sin(phase)) / 2. * top + .5;
+    words[i] = pwm_cc_word(channel, static_cast<std::uint16_t>(level));
+  }
+  return words;
+}
+
+/// A DMA channel writing words to a PWM slice compare register, one per
+/// wrap of the slice. start plays the words once; start_ring loops them,
+/// which needs them aligned to their size, a power of two bytes. position
+/// is the index of the next word to be written.
+template <typename T>
+concept pwm_dma_hal = requires(T &h, std::span<std::uint32_t const> words) {
+  h.start(words);
+  h.start_ring(words);
+  { h.busy() } -> std::convertible_to<bool>;
+  { h.position() } -> std::convertible_to<std::size_t>;
+  h.stop();
+};
+
+/// Compare register playback by DMA: once the words are started the CPU is
+/// not needed until they have all been written, or ever for a loop.
+template <pwm_dma_hal Hal> class pwm_dma_player {
+  Hal hal_;
+
+public:
+  constexpr explicit pwm_dma_player(Hal hal = {}) : hal_(std::move(hal)) {}
+
+  /// The words must stay valid until played or stopped.
+  void play(std::span<std::uint32_t const> words) {
+    hal_.stop();
+    hal_.start(words);
+  }
+  /// Loops the words until stopped. The DMA ring wraps on the read address,
+  /// so they must be aligned to their size, a power of two of at most 32k.
+  void loop(std::span<std::uint32_t const> words) {
+    auto const bytes = words.size_bytes();
+    always_assert(std::has_single_bit(bytes), bytes <= 32768,
+                  reinterpret_cast<std::uintptr_t>(words.data()) % bytes == 0);
+    hal_.stop();
+    hal_.start_ring(words);
+  }
+  void stop() { hal_.stop(); }
+  bool playing() const { return hal_.busy(); }
+  /// Index of the next word to be written.
+  std::size_t position() const { return hal_.position(); }
+  Hal &hal() noexcept { return hal_; }
+  Hal const &hal() const noexcept { return hal_; }
+};
+
+/// typed_time_queue entry stepping the led_animator returned by Fetcher, the
+/// one timer for all its channels. Queue it whenever a pattern is started.
+template <typename Fetcher>
+  requires(std::is_empty_v<Fetcher> && std::invocable<Fetcher> &&
+           std::is_lvalue_reference_v<std::invoke_result_t<Fetcher>>)
+struct led_animation_step {
+  constexpr void operator()(auto &q, auto const &tp) const {
+    if (auto n = Fetcher{}().step(tp)) {
+      q.que(*this, *n);
+    }
+  }
+};
+
+} // namespace myb
+
+#endif
@@ -2,12 +2,21 @@
 #ifndef MY_BUTTONS_MYB_MYB_HPP
 #define MY_BUTTONS_MYB_MYB_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <bitset>
+#include <charconv>
+#include <chrono>
 #include <climits>
 #include <concepts>
 #include <cstdint>
 #include <limits>
 #include <numeric>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -15,6 +24,10 @@
 #include <cgui/std-backport/tuple.hpp>
 #include <cgui/std-backport/utility.hpp>
 
+#ifndef MYB_TRACE_LATENCY
+#define MYB_TRACE_LATENCY 0
+#endif
+
 namespace myb {
 constexpr void always_assert(auto &&...conditions) {
   if (!(conditions && ...)) [[unlikely]] {
@@ -51,37 +64,258 @@ public:
   constexpr decltype(auto) trigger() { return this->get_first().trigger(); }
   constexpr decltype(auto) on_sleep() { return this->get_first().on_sleep(); }
   constexpr decltype(auto) on_wake() { return this->get_first().on_wake(); }
+  constexpr auto &action() { return this->get_first(); }
   template <typename... Ts>
     requires(std::constructible_from<_base_t, Ts...>)
   constexpr explicit(sizeof...(Ts) == 1) gpio_action_t(Ts &&...args)
       : _base_t(std::forward<Ts>(args)...) {}
 };
+template <typename T>
+concept gesture_recognizer =
+    requires() { typename std::remove_cvref_t<T>::gesture_spec; };
+template <typename T>
+concept gesture_binding = requires(T &t) {
+  { t.action() } -> gesture_recognizer;
+};
+
+enum class gpio_dispatch { fold, table };
+
+template <typename> struct gpio_pin_list;
+template <template <typename...> class Tuple, typename... Actions>
+struct gpio_pin_list<Tuple<Actions...>> {
+  static constexpr std::size_t size = sizeof...(Actions);
+  inline static constexpr std::array<std::size_t, size> pins = {
+      static_cast<std::size_t>(Actions::pin_value)...};
+  static constexpr std::size_t table_size =
+      size == 0 ? 0 : std::ranges::max(pins) + 1;
+  static constexpr std::uint32_t mask =
+      ((Actions::pin_value < 32 ? std::uint32_t{1} << Actions::pin_value
+                                : std::uint32_t{}) |
+       ... | std::uint32_t{});
+  static constexpr bool has_gestures = (gesture_binding<Actions> || ...);
+  static_assert((std::cmp_greater_equal(Actions::pin_value, 0) && ...));
+};
+
+/// Per-slot (usually per-pin) log2-bucketed latency histograms and max
+/// latency. Bucket b counts latencies in [2^(b-1), 2^b) ticks, bucket 0
+/// counts zero and the last bucket everything above. `Source` is an empty
+/// callable returning a free-running tick count, e.g. time_us_32.
+template <typename Source, std::size_t slots = 32, std::size_t buckets = 16>
+  requires(std::is_empty_v<Source> && buckets > 1)
+class latency_histograms {
+public:
+  using tick_t = std::uint32_t;
+
+private:
+  std::array<std::array<std::uint32_t, buckets>, slots> counts_{};
+  std::array<tick_t, slots> max_{};
+
+public:
+  constexpr tick_t start() const { return Source{}(); }
+  constexpr void finish(std::size_t slot, tick_t started) {
+    record(slot, static_cast<tick_t>(Source{}() - started));
+  }
+  constexpr void record(std::size_t slot, tick_t latency) {
+    if (slot < slots) {
+      auto b = std::min<std::size_t>(std::bit_width(latency), buckets - 1);
+      ++counts_[slot][b];
+      max_[slot] = std::max(max_[slot], latency);
+    }
+  }
+  constexpr std::uint32_t count(std::size_t slot, std::size_t bucket) const {
+    return counts_[slot][bucket];
+  }
+  constexpr tick_t max_latency(std::size_t slot) const { return max_[slot]; }
+  constexpr void reset() {
+    counts_ = {};
+    max_ = {};
+  }
+};
+struct no_latency_trace {
+  static constexpr std::uint32_t start() noexcept { return {}; }
+  static constexpr void finish(std::size_t, std::uint32_t) noexcept {}
+  static constexpr void record(std::size_t, std::uint32_t) noexcept {}
+};
+/// latency_histograms when MYB_TRACE_LATENCY is set, otherwise an empty
+/// type whose calls compile to nothing.
+template <typename Source, std::size_t slots = 32, std::size_t buckets = 16>
+using latency_trace =
+    std::conditional_t<MYB_TRACE_LATENCY != 0,
+                       latency_histograms<Source, slots, buckets>,
+                       no_latency_trace>;
+
 class ui_context {
-  template <typename GPIOs> class impl : GPIOs {
+  template <typename GPIOs, typename Trace> class impl : GPIOs {
     bool sleeping{};
+    std::uint32_t held_{};
+    [[no_unique_address]] Trace trace_{};
+    using pin_list_t = gpio_pin_list<GPIOs>;
+    using pin_invoker_t = std::add_pointer_t<void(impl &)>;
+    template <std::size_t i> static constexpr void invoke_at(impl &self) {
+      get<i>(static_cast<GPIOs &>(self)).trigger();
+    }
+    // Dense pin -> action table. Filled back to front so that the first
+    // binding of a pin wins, same as the fold.
+    inline static constexpr auto pin_table =
+        []<std::size_t... is>(std::index_sequence<is...>) {
+          constexpr auto last = sizeof...(is) - 1;
+          std::array<pin_invoker_t, pin_list_t::table_size> res{};
+          ((res[pin_list_t::pins[last - is]] = &invoke_at<last - is>), ...);
+          return res;
+        }(std::make_index_sequence<pin_list_t::size>{});
+
+    template <std::integral Pin> constexpr bool dispatch_fold(Pin pin) {
+      return apply_to(static_cast<GPIOs &>(*this),
+                      [pin](auto &&...actions) -> bool {
+                        auto constexpr invoker = [](auto &a, auto p) {
+                          if (a.pin_value == p) {
+                            a.trigger();
+                            return true;
+                          }
+                          return false;
+                        };
+                        return (invoker(actions, pin) || ...);
+                      });
+    }
+    template <std::integral Pin> constexpr bool dispatch_table(Pin pin) {
+      auto const index = static_cast<std::make_unsigned_t<Pin>>(pin);
+      if (index < pin_table.size()) {
+        if (auto f = pin_table[index]) {
+          f(*this);
+          return true;
+        }
+      }
+      return false;
+    }
 
   public:
     template <typename GP>
       requires(std::constructible_from<GPIOs, GP>)
     constexpr explicit impl(GP &&g) : GPIOs(std::forward<GP>(g)) {}
-    template <std::integral Pin, std::invocable CB = dtl::no_op_t>
+    /// Plain dispatch only sees presses, so contexts with gesture bindings
+    /// have to be fed both edges through gpio_edge instead.
+    template <gpio_dispatch mode = gpio_dispatch::table, std::integral Pin,
+              std::invocable CB = dtl::no_op_t>
+      requires(!pin_list_t::has_gestures)
     constexpr bool trigger_gpio(Pin pin, CB &&cb = {}) {
-      if (apply_to(static_cast<GPIOs &>(*this),
-                   [this, pin](auto &&...actions) -> bool {
-                     auto constexpr invoker = [](auto &a, auto p, auto &&self) {
-                       if (a.pin_value == p) {
-                         a.trigger();
-                         return true;
-                       }
-                       return false;
-                     };
-                     return (invoker(actions, pin, *this) || ...);
-                   })) {
+      auto const started = trace_.start();
+      bool triggered{};
+      if constexpr (mode == gpio_dispatch::table) {
+        triggered = dispatch_table(pin);
+      } else {
+        triggered = dispatch_fold(pin);
+      }
+      if (triggered) {
+        trace_.finish(static_cast<std::size_t>(pin), started);
         std::invoke(cb);
         return true;
       }
       return false;
     }
+    static constexpr std::uint32_t input_mask = pin_list_t::mask;
+    /// Triggers every bound action whose pin bit is set in `pending` in one
+    /// pass and invokes `cb` once if at least one action was triggered.
+    /// Returns the number of triggered actions.
+    template <std::invocable CB = dtl::no_op_t>
+      requires(!pin_list_t::has_gestures)
+    constexpr int trigger_gpio_mask(std::uint32_t pending, CB &&cb = {}) {
+      auto const started = trace_.start();
+      return trigger_gpio_mask(
+          pending, [started](std::size_t) { return started; },
+          std::forward<CB>(cb));
+    }
+    /// As above, but the latency of each pin is traced from `since(pin)`,
+    /// e.g. the tick its interrupt was taken at, instead of from this call.
+    template <typename Since, std::invocable CB = dtl::no_op_t>
+      requires(!pin_list_t::has_gestures &&
+               std::is_invocable_r_v<std::uint32_t, Since &, std::size_t>)
+    constexpr int trigger_gpio_mask(std::uint32_t pending, Since &&since,
+                                    CB &&cb = {}) {
+      static_assert(pin_list_t::table_size <= 32,
+                    "Mask dispatch only supports pins 0-31");
+      pending &= input_mask;
+      int count{};
+      while (pending != 0) {
+        auto const pin = static_cast<std::size_t>(std::countr_zero(pending));
+        pin_table[pin](*this);
+        trace_.finish(pin, std::invoke(since, pin));
+        pending &= pending - 1;
+        ++count;
+      }
+      if (count > 0) {
+        std::invoke(cb);
+      }
+      return count;
+    }
+    /// Feeds a press or release of `pin`. Gesture bindings see every edge
+    /// (chords depend on other pins), plain bindings of `pin` trigger on
+    /// press. Invokes `cb` once if anything fired and returns the count.
+    template <typename TimePoint, std::invocable CB = dtl::no_op_t>
+    constexpr int gpio_edge(std::uint32_t pin, bool pressed,
+                            TimePoint const &tp, CB &&cb = {}) {
+      auto const bit = pin < 32 ? std::uint32_t{1} << pin : std::uint32_t{};
+      held_ = pressed ? held_ | bit : held_ & ~bit;
+      auto const held = held_;
+      auto fired = apply_to(
+          static_cast<GPIOs &>(*this), [&](auto &&...actions) -> int {
+            auto constexpr feed = [](auto &a, std::uint32_t p, bool down,
+                                     TimePoint const &t, std::uint32_t h) {
+              if constexpr (gesture_recognizer<decltype(a.action())>) {
+                auto own = std::cmp_equal(a.pin_value, p);
+                return a.action().edge(own, down, t, h) ? 1 : 0;
+              } else if (std::cmp_equal(a.pin_value, p) && down) {
+                a.trigger();
+                return 1;
+              }
+              return 0;
+            };
+            return (feed(actions, pin, pressed, tp, held) + ... + 0);
+          });
+      if (fired > 0) {
+        std::invoke(cb);
+      }
+      return fired;
+    }
+    /// Runs the timeouts of all gesture bindings that are due at `tp`.
+    template <typename TimePoint, std::invocable CB = dtl::no_op_t>
+    constexpr int gesture_tick(TimePoint const &tp, CB &&cb = {}) {
+      auto fired = apply_to(
+          static_cast<GPIOs &>(*this), [&tp](auto &&...actions) -> int {
+            auto constexpr tick = [](auto &a, TimePoint const &t) {
+              if constexpr (gesture_recognizer<decltype(a.action())>) {
+                return a.action().tick(t) ? 1 : 0;
+              } else {
+                return 0;
+              }
+            };
+            return (tick(actions, tp) + ... + 0);
+          });
+      if (fired > 0) {
+        std::invoke(cb);
+      }
+      return fired;
+    }
+    template <typename TimePoint>
+    constexpr std::optional<TimePoint>
+    next_gesture_deadline(TimePoint const &) {
+      auto res = std::optional<TimePoint>{};
+      apply_to(static_cast<GPIOs &>(*this), [&res](auto &&...actions) {
+        auto constexpr earliest = [](auto &a, std::optional<TimePoint> &r) {
+          if constexpr (gesture_recognizer<decltype(a.action())>) {
+            auto d = a.action().template deadline<TimePoint>();
+            if (d && (!r || *d < *r)) {
+              r = d;
+            }
+          }
+          return 0;
+        };
+        (void)(earliest(actions, res) + ... + 0);
+      });
+      return res;
+    }
+    constexpr std::uint32_t held() const noexcept { return held_; }
+    constexpr Trace const &latency() const noexcept { return trace_; }
+    constexpr Trace &latency() noexcept { return trace_; }
     constexpr void sleep() {
       if (!sleeping) {
         apply_to(static_cast<GPIOs &>(*this), [](auto &&...actions) {
@@ -119,7 +353,8 @@ class ui_context {
   };
 
 public:
-  template <typename GPIOs> class builder_t {
+  template <typename GPIOs, typename Trace = no_latency_trace>
+  class builder_t {
     GPIOs gpios_;
 
   public:
@@ -130,17 +365,181 @@ public:
     template <ct_int... pins, typename... Actions,
               typename TupleType =
                   dtl::empty_structs_optimiser<gpio_action_t<pins, Actions>...>>
-    constexpr builder_t<TupleType>
+    constexpr builder_t<TupleType, Trace>
     gpios(gpio_action_t<pins, Actions> &&...actions) && {
-      return builder_t<TupleType>(TupleType(std::move(actions)...));
+      return builder_t<TupleType, Trace>(TupleType(std::move(actions)...));
+    }
+    /// Records trigger latencies in a T, e.g. a latency_trace.
+    template <typename T> constexpr builder_t<GPIOs, T> trace() && {
+      return builder_t<GPIOs, T>(std::move(*this).gpios_);
     }
-    constexpr impl<GPIOs> build() && {
-      return impl<GPIOs>(std::move(*this).gpios_);
+    constexpr impl<GPIOs, Trace> build() && {
+      return impl<GPIOs, Trace>(std::move(*this).gpios_);
     }
   };
   static constexpr builder_t<std::tuple<>> builder() { return {}; }
 };
 
+struct gpio_event {
+  std::uint8_t pin;
+  std::uint8_t edge;
+  std::uint32_t timestamp;
+};
+
+/// Fixed-capacity lock-free single-producer/single-consumer ring. Only plain
+/// atomic loads and stores are used, so it stays lock-free on cores without
+/// atomic read-modify-write (Cortex-M0+).
+template <typename T, std::size_t capacity>
+  requires(std::has_single_bit(capacity) &&
+           capacity <= std::numeric_limits<std::uint32_t>::max() / 2)
+class spsc_ring {
+  static constexpr std::uint32_t index_mask = capacity - 1;
+  std::array<T, capacity> items_{};
+  // head_ and overflows_ are only written by the producer, tail_ and
+  // high_water_ only by the consumer.
+  std::atomic<std::uint32_t> head_{};
+  std::atomic<std::uint32_t> tail_{};
+  std::atomic<std::uint32_t> overflows_{};
+  std::atomic<std::uint32_t> high_water_{};
+
+public:
+  constexpr spsc_ring() = default;
+  spsc_ring(spsc_ring const &) = delete;
+  spsc_ring &operator=(spsc_ring const &) = delete;
+
+  static constexpr std::size_t max_size() noexcept { return capacity; }
+
+  bool push(T const &v) noexcept {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == capacity) {
+      overflows_.store(overflows_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+      return false;
+    }
+    items_[head & index_mask] = v;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  /// Invokes `f` on up to `max_count` queued items in FIFO order and
+  /// releases them to the producer afterwards. Returns the number drained.
+  template <std::invocable<T const &> F>
+  std::size_t drain(F &&f, std::size_t max_count = capacity) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto fill = head_.load(std::memory_order_acquire) - tail;
+    if (fill > high_water_.load(std::memory_order_relaxed)) {
+      high_water_.store(fill, std::memory_order_relaxed);
+    }
+    auto count = std::min<std::size_t>(fill, max_count);
+    for (std::size_t i = 0; i < count; ++i) {
+      std::invoke(f, std::as_const(items_[(tail + i) & index_mask]));
+    }
+    tail_.store(tail + static_cast<std::uint32_t>(count),
+                std::memory_order_release);
+    return count;
+  }
+  std::optional<T> pop() {
+    auto res = std::optional<T>{};
+    drain([&res](T const &v) { res = v; }, 1);
+    return res;
+  }
+  bool empty() const noexcept {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_relaxed);
+  }
+  std::uint32_t overflows() const noexcept {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+  std::uint32_t high_water() const noexcept {
+    return high_water_.load(std::memory_order_relaxed);
+  }
+};
+
+/// Pushes one gpio_event per set bit in `pins`, lowest pin first.
+template <typename Ring>
+constexpr void push_gpio_edges(Ring &ring, std::uint32_t pins,
+                               std::uint8_t edge, std::uint32_t timestamp) {
+  for (; pins != 0; pins &= pins - 1) {
+    ring.push(gpio_event{static_cast<std::uint8_t>(std::countr_zero(pins)),
+                         edge, timestamp});
+  }
+}
+
+/// Drains queued gpio_events as pin masks, e.g. for
+/// ui_context::trigger_gpio_mask. A pin repeating within the drained events
+/// starts a new batch so that no edge is merged away.
+template <typename Ring, std::invocable<std::uint32_t> BatchFn>
+constexpr void drain_gpio_batches(Ring &ring, BatchFn &&batch_fn) {
+  std::uint32_t batch{};
+  ring.drain([&batch, &batch_fn](gpio_event const &e) {
+    auto bit = std::uint32_t{1} << e.pin;
+    if ((batch & bit) != 0) {
+      std::invoke(batch_fn, std::exchange(batch, 0));
+    }
+    batch |= bit;
+  });
+  if (batch != 0) {
+    std::invoke(batch_fn, batch);
+  }
+}
+
+/// Maps bit i of a value to pin i of `pins`, for writing a bitset to the
+/// pins with one masked write. Runs of consecutive pins are moved with one
+/// shift each, e.g. two for pins 20, 21, 22, 26, 27, 28.
+template <ct_int... pins>
+  requires(sizeof...(pins) > 0 && ((pins.i >= 0 && pins.i < 32) && ...))
+class gpio_bit_scatter {
+  struct run {
+    std::uint32_t bits;
+    int shift;
+  };
+  static constexpr auto pin_list = std::array{static_cast<int>(pins.i)...};
+  static constexpr std::size_t run_count = [] {
+    std::size_t n = 1;
+    for (std::size_t i = 1; i < pin_list.size(); ++i) {
+      n += pin_list[i] != pin_list[i - 1] + 1;
+    }
+    return n;
+  }();
+  static constexpr auto runs_ = [] {
+    auto res = std::array<run, run_count>{};
+    std::size_t r{};
+    for (std::size_t i = 0; i < pin_list.size(); ++i) {
+      if (i > 0 && pin_list[i] != pin_list[i - 1] + 1) {
+        ++r;
+      }
+      if (res[r].bits == 0) {
+        res[r].shift = pin_list[i] - static_cast<int>(i);
+      }
+      res[r].bits |= std::uint32_t{1} << i;
+    }
+    return res;
+  }();
+  template <std::size_t r>
+  static constexpr std::uint32_t move_run(std::uint32_t bits) noexcept {
+    constexpr auto run = runs_[r];
+    if constexpr (run.shift >= 0) {
+      return (bits & run.bits) << run.shift;
+    } else {
+      return (bits & run.bits) >> -run.shift;
+    }
+  }
+
+public:
+  static constexpr std::size_t size = sizeof...(pins);
+  static constexpr std::size_t runs = run_count;
+  static constexpr std::uint32_t mask = ((std::uint32_t{1} << pins.i) | ...);
+
+  static constexpr std::uint32_t scatter(std::uint32_t bits) noexcept {
+    return [bits]<std::size_t... rs>(std::index_sequence<rs...>) {
+      return (move_run<rs>(bits) | ...);
+    }(std::make_index_sequence<run_count>{});
+  }
+  static constexpr std::uint32_t
+  scatter(std::bitset<size> const &bits) noexcept {
+    return scatter(static_cast<std::uint32_t>(bits.to_ulong()));
+  }
+};
+
 template <ct_int> class gpio_sel_t {};
 template <ct_int pin> static constexpr gpio_sel_t<pin> gpio_sel{};
 template <ct_int pin, gpio_action Action,
@@ -155,6 +554,189 @@ constexpr ResType operator>>(gpio_sel_t<pin>,
   return ResType(action.get());
 }
 
+enum class gesture_input : std::uint8_t {
+  press,
+  release,
+  timeout,
+  chord_complete
+};
+
+/// Gesture state machines are generated from a transition table of packed
+/// bytes: the low nibble is the next state, the upper bits the effects.
+struct gesture_step {
+  static constexpr std::uint8_t state_mask = 0x0f;
+  static constexpr std::uint8_t fire = 0x10;
+  static constexpr std::uint8_t arm = 0x20;
+  static constexpr std::uint8_t disarm = 0x40;
+};
+template <std::size_t states>
+using gesture_table =
+    std::array<std::array<std::uint8_t, 4>, states>; // [state][input]
+
+/// Gesture timeouts are given in whole milliseconds, e.g.
+/// on_long_press(action, gesture_ms<800>).
+template <std::uint32_t ms> struct gesture_ms_t {};
+template <std::uint32_t ms>
+inline constexpr auto gesture_ms = gesture_ms_t<ms>{};
+
+template <std::uint32_t hold_ms> struct long_press_spec {
+  static constexpr auto timeout = std::chrono::milliseconds(hold_ms);
+  // idle, down, fired
+  static constexpr gesture_table<3> table = {{
+      {1 | gesture_step::arm, 0, 0, 0},
+      {1, 0 | gesture_step::disarm, 2 | gesture_step::fire, 1},
+      {2, 0, 2, 2},
+  }};
+};
+template <std::uint32_t window_ms> struct double_click_spec {
+  static constexpr auto timeout = std::chrono::milliseconds(window_ms);
+  // idle, first down, first up, second down
+  static constexpr gesture_table<4> table = {{
+      {1, 0, 0, 0},
+      {1, 2 | gesture_step::arm, 1, 1},
+      {3 | gesture_step::fire | gesture_step::disarm, 2, 0, 2},
+      {3, 0, 3, 3},
+  }};
+};
+template <std::uint32_t window_ms> struct chord_spec {
+  static constexpr auto timeout = std::chrono::milliseconds(window_ms);
+  // idle, own pin down and waiting for the rest, done
+  static constexpr gesture_table<3> table = {{
+      {1 | gesture_step::arm, 0, 0, 0},
+      {1, 0 | gesture_step::disarm, 2,
+       2 | gesture_step::fire | gesture_step::disarm},
+      {2, 0, 2, 2},
+  }};
+};
+
+/// Runs Action when the gesture described by Spec is recognised. The whole
+/// state is one byte (state nibble plus an armed bit) and one deadline; the
+/// timeout is part of Spec.
+template <typename Spec, typename Action, std::uint32_t chord_mask = 0>
+class gesture_action : dtl::empty_structs_optimiser<Action> {
+  using _base_t = dtl::empty_structs_optimiser<Action>;
+  using Duration = std::remove_const_t<decltype(Spec::timeout)>;
+  static constexpr std::uint8_t armed_bit = 0x80;
+  std::uint8_t state_{};
+  Duration deadline_{};
+
+  constexpr bool fire() {
+    auto &a = this->get_first();
+    if constexpr (gpio_action<decltype(a)>) {
+      a.trigger();
+    } else {
+      std::invoke(a);
+    }
+    return true;
+  }
+  template <typename TimePoint>
+  static constexpr Duration to_duration(TimePoint const &tp) {
+    return std::chrono::floor<Duration>(tp.time_since_epoch());
+  }
+  constexpr bool step(gesture_input in, Duration now) {
+    auto const packed =
+        Spec::table[state_ & gesture_step::state_mask][std::to_underlying(in)];
+    auto armed = static_cast<std::uint8_t>(state_ & armed_bit);
+    if ((packed & gesture_step::arm) != 0) {
+      deadline_ = now + Spec::timeout;
+      armed = armed_bit;
+    } else if ((packed & gesture_step::disarm) != 0 ||
+               in == gesture_input::timeout) {
+      armed = 0;
+    }
+    state_ = static_cast<std::uint8_t>((packed & gesture_step::state_mask) |
+                                       armed);
+    return (packed & gesture_step::fire) != 0 && fire();
+  }
+
+public:
+  using gesture_spec = Spec;
+  template <typename A>
+    requires(std::constructible_from<_base_t, A>)
+  constexpr explicit gesture_action(A &&a) : _base_t(std::forward<A>(a)) {}
+
+  template <typename TimePoint>
+  constexpr bool edge(bool own_pin, bool pressed, TimePoint const &tp,
+                      std::uint32_t held) {
+    auto const now = to_duration(tp);
+    // A timeout that is due but not yet ticked happened before this edge.
+    bool fired = tick(tp);
+    if (own_pin) {
+      fired = step(pressed ? gesture_input::press : gesture_input::release,
+                   now) ||
+              fired;
+    }
+    if constexpr (chord_mask != 0) {
+      if (pressed && (held & chord_mask) == chord_mask) {
+        fired = step(gesture_input::chord_complete, now) || fired;
+      }
+    }
+    return fired;
+  }
+  template <typename TimePoint> constexpr bool tick(TimePoint const &tp) {
+    if ((state_ & armed_bit) != 0 && deadline_ <= to_duration(tp)) {
+      return step(gesture_input::timeout, to_duration(tp));
+    }
+    return false;
+  }
+  template <typename TimePoint>
+  constexpr std::optional<TimePoint> deadline() const {
+    if ((state_ & armed_bit) != 0) {
+      return TimePoint(
+          std::chrono::ceil<typename TimePoint::duration>(deadline_));
+    }
+    return std::nullopt;
+  }
+  constexpr void trigger() { fire(); }
+  constexpr void on_sleep() {
+    state_ = 0;
+    if constexpr (gpio_action<Action>) {
+      this->get_first().on_sleep();
+    }
+  }
+  constexpr void on_wake() {
+    if constexpr (gpio_action<Action>) {
+      this->get_first().on_wake();
+    }
+  }
+};
+
+template <typename Action, std::uint32_t hold_ms = 500>
+constexpr auto on_long_press(Action &&a, gesture_ms_t<hold_ms> = {}) {
+  return gesture_action<long_press_spec<hold_ms>,
+                        std::unwrap_ref_decay_t<Action>>(
+      std::forward<Action>(a));
+}
+template <typename Action, std::uint32_t window_ms = 300>
+constexpr auto on_double_click(Action &&a, gesture_ms_t<window_ms> = {}) {
+  return gesture_action<double_click_spec<window_ms>,
+                        std::unwrap_ref_decay_t<Action>>(
+      std::forward<Action>(a));
+}
+/// Fires when the bound pin and all of `others` are held at once, pressed
+/// in any order within `window_ms` of the bound pin.
+template <ct_int... others, typename Action, std::uint32_t window_ms = 80>
+  requires(sizeof...(others) > 0)
+constexpr auto on_chord(Action &&a, gesture_ms_t<window_ms> = {}) {
+  constexpr auto mask = ((std::uint32_t{1} << others.i) | ...);
+  return gesture_action<chord_spec<window_ms>, std::unwrap_ref_decay_t<Action>,
+                        mask>(std::forward<Action>(a));
+}
+
+/// typed_time_queue entry running the gesture timeouts of the ui_context
+/// returned by Fetcher.
+template <typename Fetcher, typename Callback = dtl::no_op_t>
+  requires(std::is_empty_v<Fetcher> && std::is_empty_v<Callback>)
+struct gesture_timeout {
+  constexpr void operator()(auto &q, auto const &tp) const {
+    auto &ui = Fetcher{}();
+    ui.gesture_tick(tp, Callback{});
+    if (auto n = ui.next_gesture_deadline(tp)) {
+      q.que(*this, *n);
+    }
+  }
+};
+
 template <typename T>
 concept binary_output = requires(T &t) {
   t.initiate();
@@ -463,16 +1045,149 @@ public:
 template <typename T>
 calc_2_led(T &&) -> calc_2_led<std::unwrap_ref_decay_t<T>>;
 
+/// Slack of a time queue entry type: how long after its deadline the entry
+/// may run so that it can share a wakeup with other entries. Types opt in
+/// with a static `slack` member; the default is to run on time.
+template <typename T, typename Duration>
+inline constexpr Duration time_queue_slack_v = [] {
+  if constexpr (requires { T::slack; }) {
+    return std::chrono::duration_cast<Duration>(T::slack);
+  } else {
+    return Duration{};
+  }
+}();
+
 template <typename TimePoint, typename... Ts>
 class typed_time_queue : dtl::empty_structs_optimiser<Ts...> {
   using _base_t = dtl::empty_structs_optimiser<Ts...>;
+  using duration = typename TimePoint::duration;
   static constexpr auto q_size = sizeof...(Ts);
+  static constexpr std::array<duration, q_size> slacks = {
+      time_queue_slack_v<Ts, duration>...};
+  static constexpr bool has_slack =
+      ((time_queue_slack_v<Ts, duration> != duration{}) || ...);
   static consteval std::array<TimePoint, q_size> init_tps() {
     std::array<TimePoint, q_size> res{};
     std::ranges::fill(res, TimePoint::max());
     return res;
   }
-  std::array<TimePoint, q_size> time_points_ = init_tps();
+
+  static constexpr std::size_t leaf_count = std::bit_ceil(q_size);
+  using index_t = std::uint_least8_t;
+  static_assert(q_size <= std::numeric_limits<index_t>::max());
+
+  // Tournament tree over keys_: winners_[n] is the index of the earliest key
+  // below node n, winners_[1] the overall earliest. Children of n are 2n and
+  // 2n+1; node ids from leaf_count and up are the leaves, i.e. the slots
+  // themselves.
+  class tournament {
+    std::array<TimePoint, q_size> keys_ = init_tps();
+    static consteval std::array<index_t, leaf_count> init_winners() {
+      std::array<index_t, leaf_count> res{};
+      for (auto n = leaf_count; n-- > 1;) {
+        res[n] = winner_of(res, 2 * n);
+      }
+      return res;
+    }
+    static constexpr index_t
+    winner_of(std::array<index_t, leaf_count> const &winners, std::size_t n) {
+      return n >= leaf_count ? static_cast<index_t>(n - leaf_count)
+                             : winners[n];
+    }
+    std::array<index_t, leaf_count> winners_ = init_winners();
+
+  public:
+    constexpr TimePoint key(std::size_t i) const {
+      return i < q_size ? keys_[i] : TimePoint::max();
+    }
+    constexpr std::size_t front() const {
+      return leaf_count > 1 ? winners_[1] : 0;
+    }
+    constexpr std::array<TimePoint, q_size> const &keys() const {
+      return keys_;
+    }
+    constexpr void play(std::size_t n) {
+      auto l = winner_of(winners_, 2 * n);
+      auto r = winner_of(winners_, 2 * n + 1);
+      winners_[n] = key(r) < key(l) ? r : l;
+    }
+    /// Changes a key without repairing the tree, see update and rebuild.
+    constexpr void assign(std::size_t i, TimePoint const &tp) {
+      keys_[i] = tp;
+    }
+    constexpr void update(std::size_t i) {
+      for (auto n = (leaf_count + i) / 2; n >= 1; n /= 2) {
+        play(n);
+      }
+    }
+    constexpr void rebuild() {
+      for (auto n = leaf_count; n-- > 1;) {
+        play(n);
+      }
+    }
+    constexpr void set(std::size_t i, TimePoint const &tp) {
+      assign(i, tp);
+      update(i);
+    }
+  };
+  struct no_wake_times {};
+  tournament deadlines_;
+  // Latest point each entry may run, only kept if some entry has slack.
+  [[no_unique_address]] std::conditional_t<has_slack, tournament,
+                                           no_wake_times> wake_times_;
+  std::uint32_t shared_wakeups_{};
+  // Entries taken out for the running execute_all that have not run yet.
+  std::bitset<q_size> batch_{};
+  // Entries changed during execute_all, the trees are repaired afterwards.
+  std::bitset<q_size> dirty_{};
+  bool in_batch_{};
+
+  static constexpr TimePoint wake_time(std::size_t i, TimePoint const &tp) {
+    auto const late_enough =
+        tp == TimePoint::max() || tp > TimePoint::max() - slacks[i];
+    return late_enough ? tp : tp + slacks[i];
+  }
+  constexpr void assign(std::size_t i, TimePoint const &tp) {
+    deadlines_.assign(i, tp);
+    if constexpr (has_slack) {
+      wake_times_.assign(i, wake_time(i, tp));
+    }
+    dirty_[i] = true;
+  }
+  constexpr void set(std::size_t i, TimePoint const &tp) {
+    batch_[i] = false;
+    if (in_batch_) {
+      assign(i, tp);
+      return;
+    }
+    deadlines_.set(i, tp);
+    if constexpr (has_slack) {
+      wake_times_.set(i, wake_time(i, tp));
+    }
+  }
+  // Updating every changed path costs more than a rebuild once about
+  // leaf_count / depth leaves have changed.
+  constexpr void repair_trees() {
+    constexpr auto depth = std::max<std::size_t>(std::bit_width(leaf_count), 1);
+    auto const rebuild = dirty_.count() * depth >= leaf_count;
+    auto repair = [&](tournament &tree) {
+      if (rebuild) {
+        tree.rebuild();
+      } else {
+        for (std::size_t i = 0; i < q_size; ++i) {
+          if (dirty_[i]) {
+            tree.update(i);
+          }
+        }
+      }
+    };
+    repair(deadlines_);
+    if constexpr (has_slack) {
+      repair(wake_times_);
+    }
+    dirty_.reset();
+  }
+
   using ts_type_erase =
       std::add_pointer_t<void(typed_time_queue &, TimePoint const &)>;
   template <typename T>
@@ -482,9 +1197,7 @@ class typed_time_queue : dtl::empty_structs_optimiser<Ts...> {
       [](typed_time_queue &q, TimePoint const &tp) {
         get<type_index_v<Ts>>(static_cast<_base_t &>(q))(q, tp);
       }...};
-  constexpr auto next_element() {
-    return std::ranges::min_element(time_points_);
-  }
+  template <typename, typename...> friend class isr_time_queue;
 
 public:
   constexpr typed_time_queue() = default;
@@ -492,46 +1205,887 @@ public:
     requires(std::constructible_from<_base_t, Us...>)
   constexpr explicit typed_time_queue(TimePoint, Us &&...args)
       : _base_t(std::forward<Us>(args)...) {}
-  constexpr std::optional<TimePoint> next() {
-    if (auto val = next_element(); *val < TimePoint::max()) {
-      return *val;
+  /// When the next wakeup is due: the earliest deadline, or, if entries
+  /// have slack, the earliest point at which an entry would run too late.
+  constexpr std::optional<TimePoint> next() const {
+    auto val = deadlines_.key(deadlines_.front());
+    if constexpr (has_slack) {
+      val = wake_times_.key(wake_times_.front());
+    }
+    if (val < TimePoint::max()) {
+      return val;
     }
     return std::nullopt;
   }
+  /// Runs every entry that is due at tp, in deadline order. The due entries
+  /// are taken out before the first callback runs and changes made by the
+  /// callbacks only reach the trees after the last one, so an entry that
+  /// requeues itself at or before tp runs again on the next call rather than
+  /// in this one. Queueing or unqueueing an entry that has yet to run in this
+  /// call replaces its pending run.
   constexpr int execute_all(TimePoint const &tp) {
+    auto const &keys = deadlines_.keys();
+    std::array<index_t, q_size> order;
+    std::size_t batch_size{};
+    for (std::size_t i = 0; i < q_size; ++i) {
+      order[batch_size] = static_cast<index_t>(i);
+      batch_size += keys[i] <= tp && keys[i] < TimePoint::max();
+    }
+    if (batch_size == 0) {
+      return 0;
+    }
+    std::ranges::sort(order.begin(), order.begin() + batch_size,
+                      [&keys](index_t l, index_t r) {
+                        return keys[l] < keys[r] ||
+                               (keys[l] == keys[r] && l < r);
+                      });
+    std::array<TimePoint, q_size> due;
+    in_batch_ = true;
+    for (std::size_t k = 0; k < batch_size; ++k) {
+      due[k] = keys[order[k]];
+      assign(order[k], TimePoint::max());
+      batch_[order[k]] = true;
+    }
     int count{};
-    while (true) {
-      auto lowest = std::ranges::min_element(time_points_);
-      auto cur_tp = *lowest;
-      if (cur_tp <= tp) {
-        ++count;
-        *lowest = TimePoint::max();
-        auto index = std::ranges::distance(begin(time_points_), lowest);
-        ts_callbacks[index](*this, cur_tp);
-      } else {
-        return count;
+    auto last_tp = TimePoint{};
+    for (std::size_t k = 0; k < batch_size; ++k) {
+      auto index = order[k];
+      if (!batch_[index]) {
+        continue;
       }
+      batch_[index] = false;
+      if (count != 0 && last_tp != due[k]) {
+        ++shared_wakeups_;
+      }
+      ++count;
+      last_tp = due[k];
+      ts_callbacks[index](*this, due[k]);
     }
+    in_batch_ = false;
+    repair_trees();
+    return count;
+  }
+  /// Number of deadlines that ran in the same execute_all as an earlier,
+  /// distinct deadline. Slack is one way to get there, a wakeup that came
+  /// late for another reason is the other, so this is not a count of the
+  /// wakeups slack saved.
+  constexpr std::uint32_t shared_wakeups() const noexcept {
+    return shared_wakeups_;
   }
   template <typename T>
     requires((std::is_same_v<T, Ts> || ...))
   constexpr void que(T const &, TimePoint tp) {
     constexpr auto type_i = dtl::tuple_element_index_v<T, std::tuple<Ts...>>;
     static_assert(type_i < q_size);
-    time_points_[type_i] = tp;
+    set(type_i, tp);
   }
   template <typename T>
     requires((std::is_same_v<T, Ts> || ...))
   constexpr void unque(T const &) {
     constexpr auto type_i = dtl::tuple_element_index_v<T, std::tuple<Ts...>>;
     static_assert(type_i < q_size);
-    time_points_[type_i] = TimePoint::max();
+    set(type_i, TimePoint::max());
   }
 };
 template <typename TP, typename... Ts>
 typed_time_queue(TP,
                  Ts...) -> typed_time_queue<TP, std::unwrap_ref_decay_t<Ts>...>;
 
+/// typed_time_queue whose entries can also be queued from interrupt
+/// handlers. que_from_isr and unque_from_isr only publish the new deadline
+/// through a sequence lock per entry, using nothing but atomic loads and
+/// stores, and the main loop applies it in next() and execute_all(). A
+/// published deadline overrides what the main loop queued for the same entry
+/// before it was applied. Each entry may only be posted from one interrupt
+/// priority at a time.
+template <typename TimePoint, typename... Ts> class isr_time_queue {
+  using queue_t = typed_time_queue<TimePoint, Ts...>;
+  using rep = typename TimePoint::rep;
+  static_assert(std::is_integral_v<rep> &&
+                sizeof(rep) <= sizeof(std::uint64_t));
+  static constexpr auto q_size = sizeof...(Ts);
+
+  struct posted_deadline {
+    // Odd while the ISR is writing.
+    std::atomic<std::uint32_t> seq{};
+    std::atomic<std::uint32_t> low{};
+    std::atomic<std::uint32_t> high{};
+  };
+  queue_t queue_;
+  std::array<posted_deadline, q_size> posted_{};
+  std::array<std::uint32_t, q_size> applied_seq_{};
+
+  void post(std::size_t i, TimePoint const &tp) noexcept {
+    auto &p = posted_[i];
+    auto const bits = static_cast<std::uint64_t>(tp.time_since_epoch().count());
+    auto const seq = p.seq.load(std::memory_order_relaxed);
+    p.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    p.low.store(static_cast<std::uint32_t>(bits), std::memory_order_relaxed);
+    p.high.store(static_cast<std::uint32_t>(bits >> 32),
+                 std::memory_order_relaxed);
+    p.seq.store(seq + 2, std::memory_order_release);
+  }
+  void apply_posted() noexcept {
+    for (std::size_t i = 0; i < q_size; ++i) {
+      auto &p = posted_[i];
+      auto const seq = p.seq.load(std::memory_order_acquire);
+      if (seq == applied_seq_[i] || (seq & 1u) != 0) {
+        continue;
+      }
+      auto const low = p.low.load(std::memory_order_relaxed);
+      auto const high = p.high.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (p.seq.load(std::memory_order_relaxed) != seq) {
+        // Written again meanwhile, pick it up on the next call.
+        continue;
+      }
+      applied_seq_[i] = seq;
+      auto const bits = (std::uint64_t{high} << 32) | low;
+      queue_.set(i, TimePoint(typename TimePoint::duration(
+                        static_cast<rep>(bits))));
+    }
+  }
+  template <typename T>
+  static constexpr auto type_index_v =
+      dtl::tuple_element_index_v<T, std::tuple<Ts...>>;
+
+public:
+  isr_time_queue() = default;
+  template <typename... Us>
+    requires(std::constructible_from<queue_t, TimePoint, Us...>)
+  explicit isr_time_queue(TimePoint tp, Us &&...args)
+      : queue_(tp, std::forward<Us>(args)...) {}
+
+  template <typename T>
+    requires((std::is_same_v<T, Ts> || ...))
+  void que_from_isr(T const &, TimePoint tp) noexcept {
+    post(type_index_v<T>, tp);
+  }
+  template <typename T>
+    requires((std::is_same_v<T, Ts> || ...))
+  void unque_from_isr(T const &) noexcept {
+    post(type_index_v<T>, TimePoint::max());
+  }
+  template <typename T>
+    requires((std::is_same_v<T, Ts> || ...))
+  void que(T const &t, TimePoint tp) {
+    queue_.que(t, tp);
+  }
+  template <typename T>
+    requires((std::is_same_v<T, Ts> || ...))
+  void unque(T const &t) {
+    queue_.unque(t);
+  }
+  std::optional<TimePoint> next() {
+    apply_posted();
+    return queue_.next();
+  }
+  int execute_all(TimePoint const &tp) {
+    apply_posted();
+    return queue_.execute_all(tp);
+  }
+  std::uint32_t shared_wakeups() const noexcept {
+    return queue_.shared_wakeups();
+  }
+};
+template <typename TP, typename... Ts>
+isr_time_queue(TP, Ts...) -> isr_time_queue<TP, std::unwrap_ref_decay_t<Ts>...>;
+
+/// Trailing-edge debouncer. An edge is confirmed once its pin has seen no
+/// further edges for the pin's settle time. Confirmation is meant to be
+/// scheduled in a typed_time_queue through debounce_confirm.
+template <typename TimePoint, std::size_t pin_count = 32>
+  requires(pin_count <= 32)
+class gpio_debouncer {
+  using duration = typename TimePoint::duration;
+  std::array<TimePoint, pin_count> last_edge_{};
+  std::array<duration, pin_count> settle_{};
+  std::array<std::uint32_t, pin_count> first_stamp_{};
+  std::uint32_t pending_{};
+
+public:
+  constexpr gpio_debouncer() = default;
+  constexpr explicit gpio_debouncer(duration settle) {
+    std::ranges::fill(settle_, settle);
+  }
+  constexpr void settle_time(std::size_t pin, duration settle) {
+    always_assert(pin < pin_count);
+    settle_[pin] = settle;
+  }
+  constexpr duration settle_time(std::size_t pin) const {
+    always_assert(pin < pin_count);
+    return settle_[pin];
+  }
+  /// Records an edge and returns when confirm() should run next. `stamp`
+  /// is kept for the first edge of a bounce burst, see edge_stamp().
+  constexpr TimePoint edge(std::size_t pin, TimePoint const &tp,
+                           std::uint32_t stamp = {}) {
+    always_assert(pin < pin_count);
+    auto const bit = std::uint32_t{1} << pin;
+    if ((pending_ & bit) == 0) {
+      first_stamp_[pin] = stamp;
+    }
+    last_edge_[pin] = tp;
+    pending_ |= bit;
+    return *next();
+  }
+  /// The stamp of the first edge of the pin's latest burst, e.g. the
+  /// time_us_32() its interrupt was taken at.
+  constexpr std::uint32_t edge_stamp(std::size_t pin) const {
+    always_assert(pin < pin_count);
+    return first_stamp_[pin];
+  }
+  constexpr std::optional<TimePoint> next() const {
+    auto res = std::optional<TimePoint>{};
+    for (auto p = pending_; p != 0; p &= p - 1) {
+      auto pin = std::countr_zero(p);
+      auto settled = last_edge_[pin] + settle_[pin];
+      if (!res || settled < *res) {
+        res = settled;
+      }
+    }
+    return res;
+  }
+  /// Returns the mask of pending pins that have settled at `tp` and clears
+  /// them.
+  constexpr std::uint32_t confirm(TimePoint const &tp) {
+    std::uint32_t res{};
+    for (auto p = pending_; p != 0; p &= p - 1) {
+      auto pin = std::countr_zero(p);
+      if (last_edge_[pin] + settle_[pin] <= tp) {
+        res |= std::uint32_t{1} << pin;
+      }
+    }
+    pending_ &= ~res;
+    return res;
+  }
+  constexpr std::uint32_t pending() const noexcept { return pending_; }
+};
+
+struct all_pins_high {
+  constexpr std::uint32_t operator()() const noexcept {
+    return ~std::uint32_t{};
+  }
+};
+
+/// typed_time_queue entry confirming the settled edges of the debouncer
+/// returned by Fetcher and passing them as a pin mask to Dispatch. Only pins
+/// that Levels reads as high once settled are passed on: a button bounces
+/// with rising edges on release too, and those settle low. Requeues itself
+/// while edges are still pending.
+template <typename Fetcher, typename Dispatch, typename Levels = all_pins_high>
+  requires(std::is_empty_v<Fetcher> && std::invocable<Fetcher> &&
+           std::is_lvalue_reference_v<std::invoke_result_t<Fetcher>> &&
+           std::is_empty_v<Dispatch> &&
+           std::invocable<Dispatch, std::uint32_t> && std::is_empty_v<Levels> &&
+           std::is_invocable_r_v<std::uint32_t, Levels>)
+struct debounce_confirm {
+  constexpr void operator()(auto &q, auto const &tp) const {
+    auto &debouncer = Fetcher{}();
+    if (auto confirmed = debouncer.confirm(tp); confirmed != 0) {
+      if (confirmed &= std::invoke(Levels{}); confirmed != 0) {
+        std::invoke(Dispatch{}, confirmed);
+      }
+    }
+    if (auto n = debouncer.next()) {
+      q.que(*this, *n);
+    }
+  }
+};
+
+/// Heap-free hierarchical timing wheel for timers whose number is only
+/// known at runtime. Timers are the ids [0, capacity) of a static node pool
+/// and call Callback(wheel, id, deadline) when they expire. que and unque
+/// are O(1); execute_all and next have the same contract as in
+/// typed_time_queue. A timer requeued by a callback at or before the time
+/// given to execute_all waits for the next call.
+///
+/// Each level has 64 slots of 64^level ticks. A timer lives on the lowest
+/// level whose slot range still contains the current tick's upper bits and
+/// is moved down when its slot comes up. Timers beyond the top level wait
+/// in an overflow list. next finds the earliest deadline by walking the
+/// first occupied slot, so its cost grows with the timers sharing that
+/// slot.
+template <typename TimePoint, typename Tick, std::size_t capacity,
+          typename Callback, std::size_t levels = 4>
+  requires(capacity > 0 && levels > 0 && levels * 6 < 64)
+class timing_wheel : dtl::empty_structs_optimiser<Callback> {
+  using _base_t = dtl::empty_structs_optimiser<Callback>;
+  using index_t =
+      std::conditional_t<(capacity < std::numeric_limits<std::uint16_t>::max()),
+                         std::uint16_t, std::uint32_t>;
+  using tick_t = std::uint64_t;
+  static constexpr index_t nil = std::numeric_limits<index_t>::max();
+  static constexpr unsigned slot_bits = 6;
+  static constexpr std::size_t slot_count = std::size_t{1} << slot_bits;
+  static constexpr tick_t slot_mask = slot_count - 1;
+  static constexpr std::uint8_t not_queued = 0xff;
+  static constexpr std::uint8_t overflow_level = levels;
+  // Timers that already ran in the current execute_all and were requeued.
+  static constexpr std::uint8_t deferred_level = levels + 1;
+
+  struct node {
+    TimePoint deadline{};
+    index_t next = nil;
+    index_t prev = nil;
+    std::uint8_t level = not_queued;
+    std::uint8_t slot{};
+    // The execute_all call it last ran in.
+    std::uint32_t ran_in{};
+  };
+  static consteval std::array<index_t, slot_count> empty_slots() {
+    std::array<index_t, slot_count> res{};
+    std::ranges::fill(res, nil);
+    return res;
+  }
+  static consteval std::array<std::array<index_t, slot_count>, levels + 2>
+  empty_levels() {
+    std::array<std::array<index_t, slot_count>, levels + 2> res{};
+    std::ranges::fill(res, empty_slots());
+    return res;
+  }
+
+  std::array<node, capacity> nodes_{};
+  std::array<std::array<index_t, slot_count>, levels + 2> heads_ =
+      empty_levels();
+  std::array<std::uint64_t, levels + 2> occupied_{};
+  tick_t now_tick_{};
+  std::uint32_t run_{};
+  bool running_{};
+
+  static constexpr tick_t to_tick(TimePoint const &tp) {
+    auto t = std::chrono::floor<Tick>(tp.time_since_epoch()).count();
+    return t < 0 ? tick_t{} : static_cast<tick_t>(t);
+  }
+  static constexpr unsigned level_shift(std::size_t level) {
+    return static_cast<unsigned>(level * slot_bits);
+  }
+  constexpr void link(index_t id, std::uint8_t level, std::uint8_t slot) {
+    auto &n = nodes_[id];
+    auto &head = heads_[level][slot];
+    n.level = level;
+    n.slot = slot;
+    n.prev = nil;
+    n.next = head;
+    if (head != nil) {
+      nodes_[head].prev = id;
+    }
+    head = id;
+    occupied_[level] |= std::uint64_t{1} << slot;
+  }
+  constexpr void unlink(index_t id) {
+    auto &n = nodes_[id];
+    if (n.prev != nil) {
+      nodes_[n.prev].next = n.next;
+    } else {
+      heads_[n.level][n.slot] = n.next;
+      if (n.next == nil) {
+        occupied_[n.level] &= ~(std::uint64_t{1} << n.slot);
+      }
+    }
+    if (n.next != nil) {
+      nodes_[n.next].prev = n.prev;
+    }
+    n.level = not_queued;
+  }
+  constexpr void place(index_t id) {
+    auto const tick = std::max(to_tick(nodes_[id].deadline), now_tick_);
+    auto const differing = tick ^ now_tick_;
+    std::uint8_t level{};
+    while (level < levels && (differing >> level_shift(level + 1u)) != 0) {
+      ++level;
+    }
+    auto slot = level < levels ? static_cast<std::uint8_t>(
+                                     (tick >> level_shift(level)) & slot_mask)
+                               : std::uint8_t{};
+    link(id, level, slot);
+  }
+  constexpr void replace_all(std::uint8_t level, std::uint8_t slot) {
+    auto id = std::exchange(heads_[level][slot], nil);
+    occupied_[level] &= ~(std::uint64_t{1} << slot);
+    while (id != nil) {
+      auto next = nodes_[id].next;
+      place(id);
+      id = next;
+    }
+  }
+  // Moves the timers of every slot that starts at now_tick_ one or more
+  // levels down, top level first.
+  constexpr void cascade() {
+    if ((now_tick_ & ((tick_t{1} << level_shift(levels)) - 1)) == 0) {
+      replace_all(overflow_level, 0);
+    }
+    for (auto level = levels; level-- > 1;) {
+      auto const shift = level_shift(level);
+      if ((now_tick_ & ((tick_t{1} << shift) - 1)) == 0) {
+        replace_all(static_cast<std::uint8_t>(level),
+                    static_cast<std::uint8_t>((now_tick_ >> shift) &
+                                              slot_mask));
+      }
+    }
+  }
+  // Moves now_tick_ to the next tick that has level 0 timers or a cascade,
+  // but never past target.
+  constexpr void advance(tick_t target) {
+    auto const cur = now_tick_ & slot_mask;
+    auto const later =
+        cur == slot_mask ? std::uint64_t{}
+                         : occupied_[0] & (~std::uint64_t{} << (cur + 1));
+    if (later != 0) {
+      auto const slot = static_cast<tick_t>(std::countr_zero(later));
+      now_tick_ = std::min((now_tick_ & ~slot_mask) | slot, target);
+      return;
+    }
+    auto next = std::numeric_limits<tick_t>::max();
+    for (std::size_t level = 1; level < levels; ++level) {
+      if (occupied_[level] != 0) {
+        auto const block = level_shift(level + 1);
+        next = std::min(next, ((now_tick_ >> block) << block) |
+                                  (static_cast<tick_t>(
+                                       std::countr_zero(occupied_[level]))
+                                   << level_shift(level)));
+      }
+    }
+    if (occupied_[overflow_level] != 0) {
+      auto const block = level_shift(levels);
+      next = std::min(next, ((now_tick_ >> block) + 1) << block);
+    }
+    if (next > target) {
+      now_tick_ = target;
+    } else {
+      now_tick_ = next;
+      cascade();
+    }
+  }
+  constexpr int run_current_slot(TimePoint const &now) {
+    int count{};
+    auto const &head = heads_[0][now_tick_ & slot_mask];
+    auto id = head;
+    while (id != nil) {
+      if (auto deadline = nodes_[id].deadline; deadline <= now) {
+        unlink(id);
+        nodes_[id].ran_in = run_;
+        ++count;
+        std::invoke(this->get_first(), *this, static_cast<std::size_t>(id),
+                    deadline);
+        // The callback may have changed this slot, start over.
+        id = head;
+      } else {
+        id = nodes_[id].next;
+      }
+    }
+    return count;
+  }
+  constexpr std::optional<TimePoint> earliest_in(std::size_t level) const {
+    if (occupied_[level] == 0) {
+      return std::nullopt;
+    }
+    auto id = heads_[level][std::countr_zero(occupied_[level])];
+    auto res = nodes_[id].deadline;
+    for (; id != nil; id = nodes_[id].next) {
+      res = std::min(res, nodes_[id].deadline);
+    }
+    return res;
+  }
+
+public:
+  static constexpr std::size_t max_timers() noexcept { return capacity; }
+  constexpr timing_wheel() = default;
+  template <typename... Us>
+    requires(std::constructible_from<_base_t, Us...>)
+  constexpr explicit timing_wheel(TimePoint start, Us &&...args)
+      : _base_t(std::forward<Us>(args)...), now_tick_(to_tick(start)) {}
+
+  constexpr void que(std::size_t id, TimePoint tp) {
+    always_assert(id < capacity);
+    auto const i = static_cast<index_t>(id);
+    if (nodes_[i].level != not_queued) {
+      unlink(i);
+    }
+    nodes_[i].deadline = tp;
+    if (running_ && nodes_[i].ran_in == run_) {
+      link(i, deferred_level, 0);
+    } else {
+      place(i);
+    }
+  }
+  constexpr void unque(std::size_t id) {
+    always_assert(id < capacity);
+    if (auto const i = static_cast<index_t>(id);
+        nodes_[i].level != not_queued) {
+      unlink(i);
+    }
+  }
+  constexpr bool is_queued(std::size_t id) const {
+    return id < capacity && nodes_[id].level != not_queued;
+  }
+  constexpr int execute_all(TimePoint const &tp) {
+    auto const target = std::max(to_tick(tp), now_tick_);
+    int count{};
+    ++run_;
+    running_ = true;
+    while (true) {
+      count += run_current_slot(tp);
+      if (now_tick_ >= target) {
+        break;
+      }
+      advance(target);
+    }
+    running_ = false;
+    replace_all(deferred_level, 0);
+    return count;
+  }
+  constexpr std::optional<TimePoint> next() const {
+    for (std::size_t level = 0; level <= levels; ++level) {
+      if (auto res = earliest_in(level)) {
+        return res;
+      }
+    }
+    return std::nullopt;
+  }
+};
+
+/// Idle states, from shallowest to deepest. All of them keep the timers
+/// running, as the loop always waits for an alarm.
+enum class power_state : std::uint8_t { spin, wfi, deep_sleep };
+inline constexpr std::size_t power_state_count = 3;
+
+template <typename Duration> struct power_state_cost {
+  /// Time to enter and leave the state again. A state is only worth it if
+  /// the core is idle for longer; Duration::max() disables it.
+  Duration round_trip{};
+};
+template <typename Duration>
+using power_state_costs =
+    std::array<power_state_cost<Duration>, power_state_count>;
+
+template <typename T>
+concept power_hal = requires(T &hal, power_state s) {
+  { hal.now() } -> std::totally_ordered;
+  hal.enter(s);
+};
+
+/// Picks the deepest idle state that pays off before the next deadline and
+/// keeps count of how often and for how long each state was used.
+template <power_hal Hal> class power_scheduler {
+  using time_point = std::remove_cvref_t<decltype(std::declval<Hal &>().now())>;
+  using duration = typename time_point::duration;
+  [[no_unique_address]] Hal hal_;
+  power_state_costs<duration> costs_;
+  std::array<std::uint32_t, power_state_count> entries_{};
+  std::array<duration, power_state_count> residency_{};
+
+  static constexpr std::size_t index(power_state s) {
+    return static_cast<std::size_t>(s);
+  }
+
+public:
+  constexpr power_scheduler(Hal hal, power_state_costs<duration> const &costs)
+      : hal_(std::move(hal)), costs_(costs) {}
+
+  constexpr power_state
+  choose(time_point const &now,
+         std::optional<time_point> const &deadline) const {
+    auto const idle = deadline ? *deadline - now : duration::max();
+    auto res = power_state::spin;
+    for (std::size_t i = 1; i < power_state_count; ++i) {
+      auto const &c = costs_[i];
+      if (c.round_trip < idle) {
+        res = static_cast<power_state>(i);
+      }
+    }
+    return res;
+  }
+  /// Enters the chosen state until the HAL returns, which for every state
+  /// but spin is when an interrupt or the deadline's alarm fires.
+  constexpr power_state idle(std::optional<time_point> const &deadline) {
+    auto const start = hal_.now();
+    auto const state = choose(start, deadline);
+    hal_.enter(state);
+    ++entries_[index(state)];
+    residency_[index(state)] += hal_.now() - start;
+    return state;
+  }
+  constexpr std::uint32_t entries(power_state s) const {
+    return entries_[index(s)];
+  }
+  constexpr duration residency(power_state s) const {
+    return residency_[index(s)];
+  }
+  constexpr Hal &hal() noexcept { return hal_; }
+  constexpr void reset_counters() {
+    entries_ = {};
+    residency_ = {};
+  }
+};
+
+template <typename T>
+concept alarm_hal = requires(T &hal, typename T::time_point const &tp) {
+  { hal.arm(tp) } -> std::convertible_to<bool>;
+  hal.cancel();
+};
+
+/// One hardware alarm that is moved to a new target in place rather than
+/// allocated and cancelled per deadline. Hal::arm(tp) retargets it and
+/// returns true if tp had already passed, in which case it will not fire.
+template <alarm_hal Hal> class retargeting_alarm {
+  using time_point = typename Hal::time_point;
+  [[no_unique_address]] Hal hal_;
+  // time_point::min() while nothing is armed.
+  time_point target_ = time_point::min();
+  std::uint32_t arms_{};
+  std::uint32_t cancels_{};
+  std::uint32_t unchanged_{};
+
+public:
+  constexpr retargeting_alarm() = default;
+  constexpr explicit retargeting_alarm(Hal hal) : hal_(std::move(hal)) {}
+
+  /// Returns false if tp has already passed, so there is nothing to wait
+  /// for.
+  constexpr bool set(time_point const &tp) {
+    if (target_ == tp && tp != time_point::min()) {
+      ++unchanged_;
+      return true;
+    }
+    ++arms_;
+    if (hal_.arm(tp)) {
+      target_ = time_point::min();
+      return false;
+    }
+    target_ = tp;
+    return true;
+  }
+  constexpr void cancel() {
+    if (target_ != time_point::min()) {
+      ++cancels_;
+      hal_.cancel();
+      target_ = time_point::min();
+    }
+  }
+  constexpr std::optional<time_point> target() const noexcept {
+    if (target_ == time_point::min()) {
+      return std::nullopt;
+    }
+    return target_;
+  }
+  constexpr std::uint32_t arms() const noexcept { return arms_; }
+  constexpr std::uint32_t cancels() const noexcept { return cancels_; }
+  constexpr std::uint32_t unchanged() const noexcept { return unchanged_; }
+  constexpr Hal &hal() noexcept { return hal_; }
+};
+
+struct no_pending_work {
+  constexpr bool operator()() const noexcept { return false; }
+};
+
+/// What run_myb_loop needs from the target: the time, and a way to idle
+/// until wake_at or an interrupt unless has_pending() says there is work.
+/// idle_until returns whether it idled at all.
+template <typename T>
+concept loop_platform =
+    requires(T &p, typename T::time_point const &tp, no_pending_work pending) {
+      { p.now() } -> std::convertible_to<typename T::time_point>;
+      { p.idle_until(tp, pending) } -> std::convertible_to<bool>;
+    };
+
+/// Counts wakeups and the awake time that follows them per wake source.
+/// Interrupt handlers note() their source; a wakeup nobody claimed, e.g.
+/// from the alarm, goes to the `unclaimed` source.
+template <typename Source, std::size_t source_count, typename TimePoint>
+  requires(std::is_enum_v<Source> && source_count < 0xff)
+class wake_accounting {
+  using duration = typename TimePoint::duration;
+  static constexpr std::uint8_t none = 0xff;
+  std::atomic<std::uint8_t> claimed_{none};
+  std::array<std::uint32_t, source_count> wakeups_{};
+  std::array<duration, source_count> awake_{};
+  std::uint8_t unclaimed_;
+  std::uint8_t current_;
+  TimePoint awake_since_{};
+  TimePoint idle_since_{};
+
+  static constexpr std::uint8_t index(Source s) {
+    return static_cast<std::uint8_t>(s);
+  }
+
+public:
+  constexpr explicit wake_accounting(Source unclaimed)
+      : unclaimed_(index(unclaimed)), current_(index(unclaimed)) {}
+
+  /// Called from interrupt handlers; the first source since the last
+  /// wakeup gets it.
+  void note(Source s) noexcept {
+    auto expected = none;
+    claimed_.compare_exchange_strong(expected, index(s),
+                                     std::memory_order_relaxed);
+  }
+  void woke(TimePoint const &now) noexcept {
+    auto const claimed = claimed_.exchange(none, std::memory_order_relaxed);
+    current_ = claimed < source_count ? claimed : unclaimed_;
+    ++wakeups_[current_];
+    awake_since_ = now;
+  }
+  void idle(TimePoint const &now) noexcept {
+    awake_[current_] += now - awake_since_;
+    idle_since_ = now;
+    claimed_.store(none, std::memory_order_relaxed);
+  }
+  /// Takes back the last idle() when the core did not idle after all: the
+  /// time since counts as awake and there is no wakeup.
+  void stayed_awake() noexcept {
+    awake_[current_] -= idle_since_ - awake_since_;
+  }
+
+  std::uint32_t wakeups(Source s) const noexcept {
+    return wakeups_[index(s)];
+  }
+  duration awake(Source s) const noexcept { return awake_[index(s)]; }
+  void reset() noexcept {
+    wakeups_ = {};
+    awake_ = {};
+  }
+
+  /// Writes one "<name> <wakeups> <awake us>" line per source and returns
+  /// the written part of `out`, cut short if it does not fit.
+  std::string_view
+  report(std::span<char> out,
+         std::span<std::string_view const, source_count> names) const {
+    auto *cur = out.data();
+    auto *const end = cur + out.size();
+    auto put = [&](std::string_view text) {
+      auto n = std::min(text.size(), static_cast<std::size_t>(end - cur));
+      cur = std::copy_n(text.data(), n, cur);
+    };
+    auto put_number = [&](auto value) {
+      if (auto res = std::to_chars(cur, end, value); res.ec == std::errc{}) {
+        cur = res.ptr;
+      } else {
+        cur = end;
+      }
+    };
+    for (std::size_t i = 0; i < source_count; ++i) {
+      put(names[i]);
+      put(" ");
+      put_number(wakeups_[i]);
+      put(" ");
+      put_number(
+          std::chrono::duration_cast<std::chrono::microseconds>(awake_[i])
+              .count());
+      put("\n");
+    }
+    return {out.data(), static_cast<std::size_t>(cur - out.data())};
+  }
+};
+
+/// Counts events in whole seconds of TimePoint. per_second() is the count of
+/// the last second that has passed, and peak() the highest one seen.
+template <typename TimePoint> class per_second_counter {
+  TimePoint second_start_{};
+  std::uint32_t count_{};
+  std::uint32_t last_{};
+  std::uint32_t peak_{};
+  bool started_{};
+
+  constexpr void roll(TimePoint const &tp) noexcept {
+    using namespace std::chrono;
+    if (!std::exchange(started_, true)) {
+      second_start_ = tp;
+      return;
+    }
+    auto const elapsed = tp - second_start_;
+    if (elapsed < seconds(1)) {
+      return;
+    }
+    last_ = elapsed < seconds(2) ? count_ : 0;
+    peak_ = std::max(peak_, count_);
+    count_ = 0;
+    second_start_ = tp - elapsed % seconds(1);
+  }
+
+public:
+  constexpr void note(TimePoint const &tp) noexcept {
+    roll(tp);
+    ++count_;
+  }
+  /// Closes the seconds that have passed by tp without events.
+  constexpr void advance(TimePoint const &tp) noexcept { roll(tp); }
+  constexpr std::uint32_t per_second() const noexcept { return last_; }
+  constexpr std::uint32_t peak() const noexcept { return peak_; }
+};
+
+/// The main loop: runs the async tasks and idles in between until the
+/// sleep point passes. sleep_at is read again on every round, so tasks may
+/// move it; once the loop is awake within sleep_slack of it, it returns
+/// rather than wake up again just for it.
+template <loop_platform Platform, typename AsyncTasks,
+          std::predicate PendingWork = no_pending_work>
+  requires(requires(std::invoke_result_t<AsyncTasks &&,
+                                         typename Platform::time_point> r) {
+    { *r } -> std::convertible_to<typename Platform::time_point>;
+  })
+void run_myb_loop(Platform &platform,
+                  typename Platform::time_point const &sleep_at,
+                  typename Platform::time_point::duration sleep_slack,
+                  AsyncTasks &&run_async_tasks,
+                  PendingWork &&has_pending = {}) {
+  auto now_time = platform.now();
+  while (now_time < sleep_at) {
+    auto next_task_time = run_async_tasks(now_time);
+    if (sleep_at - now_time <= sleep_slack) {
+      break;
+    }
+    // Tasks that are already due again are run on the next round; an alarm
+    // does not fire for a point in the past.
+    if (!next_task_time || *next_task_time > now_time) {
+      auto const wake_at = next_task_time && *next_task_time < sleep_at
+                               ? typename Platform::time_point(*next_task_time)
+                               : sleep_at;
+      platform.idle_until(wake_at, has_pending);
+    }
+    now_time = platform.now();
+  }
+}
+
+/// What woke the core, as booked by the apps.
+enum class wake_source : std::uint8_t { alarm, gpio, wake_rx, dma };
+inline constexpr std::size_t wake_source_count = 4;
+inline constexpr std::array<std::string_view, wake_source_count>
+    wake_source_names = {"alarm", "gpio", "wake_rx", "dma"};
+
+/// loop_platform that books every idle period and wakeup in a
+/// wake_accounting. The time from construction to destruction counts as one
+/// wakeup, i.e. whatever woke the core before the loop started.
+template <loop_platform Platform, typename Accounting>
+class accounted_loop_platform {
+  Platform *platform_;
+  Accounting *accounting_;
+
+public:
+  using time_point = typename Platform::time_point;
+  accounted_loop_platform(Platform &platform, Accounting &accounting)
+      : platform_(&platform), accounting_(&accounting) {
+    accounting_->woke(platform_->now());
+  }
+  accounted_loop_platform(accounted_loop_platform const &) = delete;
+  accounted_loop_platform &operator=(accounted_loop_platform const &) = delete;
+  ~accounted_loop_platform() { accounting_->idle(platform_->now()); }
+
+  time_point now() { return platform_->now(); }
+  bool idle_until(time_point const &wake_at,
+                  std::predicate auto &&has_pending) {
+    accounting_->idle(platform_->now());
+    if (!platform_->idle_until(wake_at, has_pending)) {
+      // Not idled, so no wakeup either.
+      accounting_->stayed_awake();
+      return false;
+    }
+    accounting_->woke(platform_->now());
+    return true;
+  }
+};
+
 template <typename Fetcher>
   requires(std::is_empty_v<Fetcher> && std::invocable<Fetcher> &&
            std::is_lvalue_reference_v<std::invoke_result_t<Fetcher>>)
@@ -0,0 +1,351 @@
+#ifndef MY_BUTTONS_MYB_SIM_HPP
+#define MY_BUTTONS_MYB_SIM_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ranges>
+#include <span>
+
+#include <myb/adc.hpp>
+#include <myb/led.hpp>
+#include <myb/myb.hpp>
+
+namespace myb {
+
+/// Virtual clock for host simulations. It only moves when a simulation
+/// platform idles, so hours of use run in milliseconds.
+struct sim_clock {
+  using rep = std::int64_t;
+  using period = std::micro;
+  using duration = std::chrono::duration<rep, period>;
+  using time_point = std::chrono::time_point<sim_clock>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept { return now_; }
+  static void set(time_point tp) noexcept { now_ = tp; }
+
+private:
+  inline static time_point now_{};
+};
+
+/// The simulated counterpart of time_us_32().
+inline std::uint32_t sim_time_us_32() noexcept {
+  return static_cast<std::uint32_t>(
+      sim_clock::now().time_since_epoch().count());
+}
+
+template <typename T>
+concept sim_event = requires(T const &e) {
+  { e.at } -> std::convertible_to<sim_clock::time_point>;
+};
+
+struct sim_gpio_edge {
+  sim_clock::time_point at;
+  std::uint8_t pin;
+  std::uint8_t edge;
+};
+
+/// alarm_hal for simulations, counting what the hardware would be asked.
+struct counting_alarm_hal {
+  using time_point = sim_clock::time_point;
+  std::uint32_t arms{};
+  std::uint32_t cancels{};
+  bool arm(time_point const &tp) noexcept {
+    ++arms;
+    return tp <= sim_clock::now();
+  }
+  void cancel() noexcept { ++cancels; }
+};
+
+/// adc_dma_hal for host simulations: a DMA channel fed by an ADC that
+/// repeats the given samples. complete() runs the started transfer to its
+/// end, as the ADC would pace it.
+class sim_adc_dma {
+  std::span<std::uint16_t const> samples_;
+  std::size_t next_sample_{};
+  std::span<std::uint32_t> dst_{};
+  std::uint32_t transfers_{};
+  std::uint32_t sniffed_{};
+  bool sniffing_{};
+  std::uint32_t acks_{};
+
+  std::uint16_t convert() {
+    auto const s = samples_[next_sample_];
+    next_sample_ = next_sample_ + 1 == samples_.size() ? 0 : next_sample_ + 1;
+    return s;
+  }
+
+public:
+  explicit sim_adc_dma(std::span<std::uint16_t const> samples)
+      : samples_(samples) {}
+
+  void start_packed(std::span<std::uint32_t> dst) {
+    dst_ = dst;
+    transfers_ = static_cast<std::uint32_t>(dst.size() * 2);
+    sniffing_ = false;
+  }
+  void start_sniffed(std::uint32_t transfers) {
+    dst_ = {};
+    transfers_ = transfers;
+    sniffed_ = 0;
+    sniffing_ = true;
+  }
+  std::uint32_t sniffed_sum() const noexcept { return sniffed_; }
+  void ack() noexcept { ++acks_; }
+  void abort() noexcept { transfers_ = 0; }
+
+  void complete() {
+    for (std::uint32_t i = 0; i < transfers_; ++i) {
+      auto const s = convert();
+      if (sniffing_) {
+        sniffed_ += s;
+      } else {
+        auto &w = dst_[i / 2];
+        w = i % 2 == 0 ? (w & 0xffff0000u) | s
+                       : (w & 0xffffu) | (std::uint32_t{s} << 16);
+      }
+    }
+    transfers_ = 0;
+  }
+  std::uint32_t acks() const noexcept { return acks_; }
+};
+
+/// chained_adc_dma_hal for host simulations: two DMA channels fed by an ADC
+/// that repeats the given samples. convert(n) lets the ADC produce n samples,
+/// each going to the running channel or, if none is running, overflowing
+/// the FIFO. A ping_pong channel is moved back to the start of its words
+/// when it finishes, as by its control channel. A channel that runs out of
+/// its words counts a stray write instead of writing outside them.
+class sim_chained_adc_dma {
+  struct channel {
+    std::span<std::uint32_t> words{};
+    std::uint32_t write{};
+    // Samples after which the write index wraps, 0 for no ring.
+    std::uint32_t ring{};
+    std::uint32_t count{};
+    std::uint32_t reload{};
+    std::size_t chain_to{};
+    bool busy{};
+    bool rewind{};
+  };
+  std::span<std::uint16_t const> samples_;
+  std::size_t next_sample_{};
+  std::array<channel, 2> channels_{};
+  std::uint32_t completed_{};
+  bool fifo_overflow_{};
+  std::uint32_t stray_writes_{};
+  std::uint32_t overflowed_samples_{};
+
+  void write(channel &c, std::uint16_t s) {
+    auto const i = c.ring != 0 ? c.write % c.ring : c.write;
+    ++c.write;
+    if (i / 2 >= c.words.size()) {
+      ++stray_writes_;
+      return;
+    }
+    auto &w = c.words[i / 2];
+    w = i % 2 == 0 ? (w & 0xffff0000u) | s
+                   : (w & 0xffffu) | (std::uint32_t{s} << 16);
+  }
+
+public:
+  explicit sim_chained_adc_dma(std::span<std::uint16_t const> samples)
+      : samples_(samples) {}
+
+  void start_ping_pong(std::span<std::uint32_t> first,
+                       std::span<std::uint32_t> second) {
+    auto const count = static_cast<std::uint32_t>(first.size() * 2);
+    channels_[0] = {first, 0, 0, count, count, 1, true, true};
+    channels_[1] = {second, 0, 0, count, count, 0, false, true};
+  }
+  void start_ring(std::span<std::uint32_t> buffer, std::uint32_t block) {
+    // The control channel that retriggers the data channel is modelled as
+    // the data channel chaining to itself.
+    auto const ring = static_cast<std::uint32_t>(buffer.size() * 2);
+    channels_[0] = {buffer, 0, ring, block, block, 0, true};
+    channels_[1] = {};
+  }
+  std::uint32_t take_completed() noexcept {
+    return std::exchange(completed_, 0);
+  }
+  std::size_t ring_position() const noexcept {
+    return channels_[0].write % channels_[0].ring;
+  }
+  bool take_fifo_overflow() noexcept {
+    return std::exchange(fifo_overflow_, false);
+  }
+  void abort() noexcept {
+    for (auto &c : channels_) {
+      c.busy = false;
+    }
+    completed_ = 0;
+  }
+
+  void convert(std::size_t n) {
+    for (; n > 0; --n) {
+      auto const s = samples_[next_sample_];
+      next_sample_ = next_sample_ + 1 == samples_.size() ? 0 : next_sample_ + 1;
+      auto running = std::ranges::find_if(channels_, &channel::busy);
+      if (running == channels_.end()) {
+        fifo_overflow_ = true;
+        ++overflowed_samples_;
+        continue;
+      }
+      write(*running, s);
+      if (--running->count == 0) {
+        running->busy = false;
+        running->count = running->reload;
+        if (running->rewind) {
+          running->write = 0;
+        }
+        auto const i = static_cast<std::size_t>(running - channels_.begin());
+        completed_ |= 1u << i;
+        channels_[running->chain_to].busy = true;
+      }
+    }
+  }
+  std::uint32_t stray_writes() const noexcept { return stray_writes_; }
+  std::uint32_t overflowed_samples() const noexcept {
+    return overflowed_samples_;
+  }
+};
+
+/// pwm_dma_hal for host simulations: a DMA channel writing the compare
+/// register of a PWM slice. Each wrap() of the slice requests one word,
+/// which the channel writes if it is running.
+class sim_pwm_dma {
+  std::span<std::uint32_t const> words_{};
+  std::size_t next_{};
+  bool ring_{};
+  bool busy_{};
+  std::uint32_t cc_{};
+  std::uint32_t writes_{};
+
+  void begin(std::span<std::uint32_t const> words, bool ring) {
+    words_ = words;
+    next_ = 0;
+    ring_ = ring;
+    busy_ = !words.empty();
+  }
+
+public:
+  void start(std::span<std::uint32_t const> words) { begin(words, false); }
+  void start_ring(std::span<std::uint32_t const> words) { begin(words, true); }
+  bool busy() const noexcept { return busy_; }
+  std::size_t position() const noexcept { return next_; }
+  void stop() noexcept { busy_ = false; }
+
+  /// Returns the compare register after the wrap.
+  std::uint32_t wrap() {
+    if (busy_) {
+      cc_ = words_[next_];
+      ++writes_;
+      if (++next_ == words_.size()) {
+        next_ = ring_ ? 0 : next_;
+        busy_ = ring_;
+      }
+    }
+    return cc_;
+  }
+  std::uint32_t cc() const noexcept { return cc_; }
+  std::uint32_t writes() const noexcept { return writes_; }
+};
+
+/// loop_platform for host simulations. Idling jumps the virtual clock to the
+/// wake point or to the next scripted event, whichever is first, and hands
+/// every due event to OnEvent as an interrupt handler would get it. The
+/// script must be sorted by time. The wake point goes through a
+/// retargeting_alarm as on the target, so its operations can be counted.
+template <sim_event Event, std::invocable<Event const &> OnEvent>
+class sim_loop_platform {
+  std::span<Event const> script_;
+  std::size_t next_event_{};
+  [[no_unique_address]] OnEvent on_event_;
+  retargeting_alarm<counting_alarm_hal> alarm_;
+  std::uint32_t idles_{};
+  std::uint32_t event_wakeups_{};
+  std::uint32_t sleeps_{};
+  sim_clock::duration idle_time_{};
+  sim_clock::duration sleep_time_{};
+
+  void deliver_due() {
+    while (next_event_ < script_.size() &&
+           script_[next_event_].at <= sim_clock::now()) {
+      std::invoke(on_event_, script_[next_event_]);
+      ++next_event_;
+    }
+  }
+  sim_clock::duration jump_to(sim_clock::time_point const &tp) {
+    auto const now = sim_clock::now();
+    if (tp <= now) {
+      return {};
+    }
+    sim_clock::set(tp);
+    return tp - now;
+  }
+
+public:
+  using time_point = sim_clock::time_point;
+
+  sim_loop_platform(std::span<Event const> script, OnEvent on_event)
+      : script_(script), on_event_(std::move(on_event)) {}
+
+  static time_point now() noexcept { return sim_clock::now(); }
+  bool idle_until(time_point const &wake_at,
+                  std::predicate auto &&has_pending) {
+    // Retargets the alarm like the target does.
+    if (!alarm_.set(wake_at) || has_pending()) {
+      return false;
+    }
+    ++idles_;
+    auto target = wake_at;
+    if (auto event = next_event_at(); event && *event < target) {
+      target = *event;
+      ++event_wakeups_;
+    }
+    idle_time_ += jump_to(target);
+    deliver_due();
+    return true;
+  }
+  /// Sleeps until the next scripted event, as the apps do once their loop
+  /// returns. Returns false once the script has run out.
+  bool sleep_until_event() {
+    auto event = next_event_at();
+    if (!event) {
+      return false;
+    }
+    ++sleeps_;
+    sleep_time_ += jump_to(*event);
+    deliver_due();
+    return true;
+  }
+  std::optional<time_point> next_event_at() const {
+    if (next_event_ < script_.size()) {
+      return script_[next_event_].at;
+    }
+    return std::nullopt;
+  }
+
+  /// Times the loop idled, and how many of those ended on an event rather
+  /// than on the wake point.
+  std::uint32_t idles() const noexcept { return idles_; }
+  std::uint32_t event_wakeups() const noexcept { return event_wakeups_; }
+  std::uint32_t sleeps() const noexcept { return sleeps_; }
+  sim_clock::duration idle_time() const noexcept { return idle_time_; }
+  sim_clock::duration sleep_time() const noexcept { return sleep_time_; }
+  retargeting_alarm<counting_alarm_hal> const &alarm() const noexcept {
+    return alarm_;
+  }
+};
+template <std::ranges::contiguous_range Script, typename OnEvent>
+sim_loop_platform(Script const &, OnEvent)
+    -> sim_loop_platform<std::ranges::range_value_t<Script>, OnEvent>;
+
+} // namespace myb
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef MY_BUTTONS_MYB_TASK_HPP
+#define MY_BUTTONS_MYB_TASK_HPP
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+#include <myb/myb.hpp>
+
+namespace myb {
+
+template <typename Tag, std::size_t frame_bytes> class co_slot;
+template <typename TimePoint> class co_task;
+
+/// Promise of co_task. Keeps the time point the task was last resumed at,
+/// so that sleeps are measured from the deadline rather than from when
+/// execute_all got around to it, and how to queue the task again.
+template <typename TimePoint> class co_promise {
+  using requeue_fn = void (*)(void *, TimePoint const &);
+  TimePoint now_{};
+  void *queue_{};
+  requeue_fn requeue_{};
+  bool *frame_used_{};
+  std::uint32_t edge_mask_{};
+  std::uint32_t edges_{};
+
+public:
+  template <typename Tag, std::size_t frame_bytes, typename... Args>
+  explicit co_promise(co_slot<Tag, frame_bytes> const &,
+                      Args const &...) noexcept
+      : frame_used_(&co_slot<Tag, frame_bytes>::frame_used_) {}
+  co_promise(co_promise const &) = delete;
+  co_promise &operator=(co_promise const &) = delete;
+  ~co_promise() { *frame_used_ = false; }
+
+  /// Frames only come from the co_slot passed as first argument to the
+  /// coroutine, there is no heap fallback.
+  template <typename Tag, std::size_t frame_bytes, typename... Args>
+  static void *operator new(std::size_t size,
+                            co_slot<Tag, frame_bytes> const &,
+                            Args const &...) {
+    return co_slot<Tag, frame_bytes>::allocate(size);
+  }
+  static void operator delete(void *, std::size_t) noexcept {}
+
+  co_task<TimePoint> get_return_object() noexcept {
+    return co_task<TimePoint>(
+        std::coroutine_handle<co_promise>::from_promise(*this));
+  }
+  static std::suspend_always initial_suspend() noexcept { return {}; }
+  static std::suspend_always final_suspend() noexcept { return {}; }
+  static void return_void() noexcept {}
+  [[noreturn]] static void unhandled_exception() noexcept { std::abort(); }
+
+  constexpr TimePoint const &now() const noexcept { return now_; }
+  void requeue(TimePoint const &tp) { requeue_(queue_, tp); }
+  template <typename Queue, typename Entry>
+  constexpr void bind(Queue &q, Entry const &, TimePoint const &tp) noexcept {
+    queue_ = &q;
+    requeue_ = [](void *queue, TimePoint const &at) {
+      static_cast<Queue *>(queue)->que(Entry{}, at);
+    };
+    now_ = tp;
+  }
+  constexpr void wait_edges(std::uint32_t mask) noexcept {
+    edge_mask_ = mask;
+    edges_ = 0;
+  }
+  /// Returns true if the task was waiting for any of the pins.
+  constexpr bool notify_edges(std::uint32_t pins) noexcept {
+    auto const hits = pins & edge_mask_;
+    if (hits == 0) {
+      return false;
+    }
+    edges_ = hits;
+    edge_mask_ = 0;
+    return true;
+  }
+  constexpr std::uint32_t const &edges() const noexcept { return edges_; }
+};
+
+/// Return type of coroutines run by a co_slot. A co_task only owns its frame
+/// until it is handed to co_slot::start.
+template <typename TimePoint> class [[nodiscard]] co_task {
+public:
+  using promise_type = co_promise<TimePoint>;
+
+private:
+  std::coroutine_handle<promise_type> handle_{};
+  constexpr explicit co_task(std::coroutine_handle<promise_type> h) noexcept
+      : handle_(h) {}
+  friend promise_type;
+  template <typename, std::size_t> friend class co_slot;
+
+public:
+  constexpr co_task() noexcept = default;
+  constexpr co_task(co_task &&other) noexcept
+      : handle_(std::exchange(other.handle_, {})) {}
+  co_task &operator=(co_task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  ~co_task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+  constexpr explicit operator bool() const noexcept {
+    return static_cast<bool>(handle_);
+  }
+};
+
+/// Awaitable returned by sleep_for. Resumes the task once the duration has
+/// passed since the deadline it last ran at.
+template <typename Duration> struct co_sleep {
+  Duration d;
+  static constexpr bool await_ready() noexcept { return false; }
+  template <typename TimePoint>
+  void await_suspend(std::coroutine_handle<co_promise<TimePoint>> h) {
+    auto &p = h.promise();
+    p.requeue(p.now() + std::chrono::ceil<typename TimePoint::duration>(d));
+  }
+  static constexpr void await_resume() noexcept {}
+};
+template <typename Rep, typename Period>
+constexpr co_sleep<std::chrono::duration<Rep, Period>>
+sleep_for(std::chrono::duration<Rep, Period> const &d) noexcept {
+  return {d};
+}
+
+/// Awaitable returned by next_edge. Resumes the task on the first
+/// co_slot::notify_edges naming any of its pins; yields the pins of that
+/// call that it waited for.
+class co_edge {
+  std::uint32_t mask_;
+  std::uint32_t const *edges_{};
+
+public:
+  constexpr explicit co_edge(std::uint32_t mask) noexcept : mask_(mask) {}
+  static constexpr bool await_ready() noexcept { return false; }
+  template <typename Promise>
+  constexpr void await_suspend(std::coroutine_handle<Promise> h) noexcept {
+    h.promise().wait_edges(mask_);
+    edges_ = &h.promise().edges();
+  }
+  constexpr std::uint32_t await_resume() const noexcept { return *edges_; }
+};
+constexpr co_edge next_edge(std::uint32_t pin) noexcept {
+  return co_edge(std::uint32_t{1} << pin);
+}
+constexpr co_edge next_edges(std::uint32_t pins) noexcept {
+  return co_edge(pins);
+}
+
+template <typename> struct co_slot_slack {};
+template <typename Tag>
+  requires requires { Tag::slack; }
+struct co_slot_slack<Tag> {
+  static constexpr auto slack = Tag::slack;
+};
+
+/// typed_time_queue entry that runs one coroutine at a time out of a static
+/// frame of frame_bytes. Each Tag names its own slot, and through a static
+/// `slack` member its slack in the queue. A coroutine is bound to the slot
+/// by taking the slot as its first argument:
+///
+///   co_task<time_point> blink(co_slot<blink_tag>) {
+///     for (;;) {
+///       led::set(1);
+///       co_await sleep_for(100ms);
+///       led::set(0);
+///       co_await next_edge(button_pin);
+///     }
+///   }
+///   co_slot<blink_tag>::start(queue, blink({}), now);
+///
+/// The task is resumed by the queue's execute_all. A frame that is too small
+/// for the coroutine aborts when the coroutine is called.
+template <typename Tag, std::size_t frame_bytes = 256>
+class co_slot : public co_slot_slack<Tag> {
+  alignas(std::max_align_t) inline static std::array<std::byte, frame_bytes>
+      frame_{};
+  inline static bool frame_used_{};
+  inline static void *running_{};
+
+  static void *allocate(std::size_t size) {
+    always_assert(size <= frame_bytes, !frame_used_);
+    frame_used_ = true;
+    return frame_.data();
+  }
+  template <typename TimePoint>
+  static co_promise<TimePoint> &promise() noexcept {
+    return std::coroutine_handle<co_promise<TimePoint>>::from_address(running_)
+        .promise();
+  }
+  template <typename> friend class co_promise;
+
+public:
+  /// Hands the task to the slot and queues its first run at tp.
+  template <typename Queue, typename TimePoint>
+  static void start(Queue &q, co_task<TimePoint> &&task, TimePoint const &tp) {
+    always_assert(task.handle_.address() == frame_.data(), running_ == nullptr);
+    running_ = std::exchange(task.handle_, {}).address();
+    q.que(co_slot{}, tp);
+  }
+  /// Destroys the running task, if any.
+  template <typename Queue> static void stop(Queue &q) {
+    if (running_ != nullptr) {
+      q.unque(co_slot{});
+      std::coroutine_handle<>::from_address(std::exchange(running_, nullptr))
+          .destroy();
+    }
+  }
+  static bool running() noexcept { return running_ != nullptr; }
+  /// Queues the task at tp if it waits for an edge on any of the pins.
+  template <typename Queue, typename TimePoint>
+  static void notify_edges(Queue &q, std::uint32_t pins, TimePoint const &tp) {
+    if (running_ != nullptr && promise<TimePoint>().notify_edges(pins)) {
+      q.que(co_slot{}, tp);
+    }
+  }
+  template <typename Queue, typename TimePoint>
+  void operator()(Queue &q, TimePoint const &tp) const {
+    if (running_ == nullptr) {
+      return;
+    }
+    auto h =
+        std::coroutine_handle<co_promise<TimePoint>>::from_address(running_);
+    h.promise().bind(q, *this, tp);
+    h.resume();
+    if (h.done()) {
+      running_ = nullptr;
+      h.destroy();
+    }
+  }
+};
+
+} // namespace myb
+
+#endif
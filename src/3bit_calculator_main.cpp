@@ -16,24 +16,21 @@ inline namespace {
 
 struct do_init_t {};
 
-struct led_binary_out_base {
-  template <ct_int... pins, std::size_t... is>
-    requires(sizeof...(is) == sizeof...(pins))
-  static void do_set(std::bitset<sizeof...(pins)> const &vals,
-                     std::index_sequence<is...>) {
-    (void)(set_gpio_out(pins.i, vals[is]) + ...);
-  }
-};
-
-template <ct_int... pins> struct led_binary_out : private led_binary_out_base {
-
-  static void init() { (void)(init_gpio_for_output(pins.i) + ...); }
+// Writes all its pins at once with one masked write, so that no
+// intermediate value shows on the LEDs.
+template <ct_int... pins> struct led_binary_out {
+  using scatter_t = gpio_bit_scatter<pins...>;
+  static constexpr auto mask = scatter_t::mask;
 
+  static void init() {
+    gpio_init_mask(mask);
+    gpio_set_dir_out_masked(mask);
+  }
   static void set(std::bitset<sizeof...(pins)> const &vals) {
-    do_set<pins...>(vals, std::make_index_sequence<sizeof...(pins)>{});
+    gpio_put_masked(mask, scatter_t::scatter(vals));
   }
-  static void set_all(int val) { (void)(set_gpio_out(pins.i, val) + ...); }
-  static void sleep() { (void)(set_gpio_out(pins.i, 0) + ...); }
+  static void set_all(int val) { gpio_put_masked(mask, val != 0 ? mask : 0); }
+  static void sleep() { gpio_clr_mask(mask); }
   static constexpr auto out_size = sizeof...(pins);
 };
 
@@ -105,6 +102,7 @@ public:
 };
 
 template <led_binary_out_c Out> struct flash_binary_out {
+  static constexpr auto slack = std::chrono::milliseconds(50);
   constexpr void operator()(auto &&q, auto &&tp) {
     using namespace std::chrono;
     auto flash_val = static_cast<int>(
@@ -128,9 +126,19 @@ using calc_rhs_out_pins = led_binary_out<13, 14, 15>;
 using calc_lhs_out_pins = led_binary_out<17, 18, 19>;
 using calc_res_out_pins = led_binary_out<20, 21, 22, 26, 27, 28>;
 using calc_flasher = flash_binary_out<calc_res_out_pins>;
+inline constexpr auto debounce_settle = std::chrono::milliseconds(5);
+static auto debouncer =
+    gpio_debouncer<steady_clock::time_point>(debounce_settle);
+struct debounced_dispatch {
+  void operator()(std::uint32_t pins) const;
+};
+using debounce_confirm_t =
+    debounce_confirm<decltype([]() -> auto & { return debouncer; }),
+                     debounced_dispatch,
+                     decltype([] { return gpio_get_all(); })>;
 static auto timed_queue =
     typed_time_queue(steady_clock::time_point{}, calc_flasher{},
-                     call_static_reset<wake_other_t>{});
+                     call_static_reset<wake_other_t>{}, debounce_confirm_t{});
 using calc_output_t =
     calc_output<calc_lhs_out_pins, calc_rhs_out_pins, calc_res_out_pins,
                 calc_op_pins, decltype([]() {
@@ -148,6 +156,7 @@ inline constexpr auto calc_no_res_flash_timeout = std::chrono::seconds(1);
 
 static auto ui_context_calc =
     ui_context::builder()
+        .trace<us_latency_trace<>>()
         .gpios( //
             gpio_sel<16> >> rotate_calc3b([]() -> auto & { return calc_wrap; },
                                           std::type_identity<calc_output_t>{},
@@ -197,25 +206,53 @@ std::optional<steady_clock::time_point> run_async_tasks(auto now) {
   return timed_queue.next();
 }
 
-void gpio_irq(uint gpio, std::uint32_t events) {
-  constexpr std::uint32_t edge_rise_mask = 0b1000u;
-  // We only care about edge rise.
-  if ((events & edge_rise_mask) == 0) {
+inline constexpr std::uint32_t wake_rx_mask = 1u << wake_rx_gpio;
+inline constexpr std::uint32_t gpio_irq_mask =
+    decltype(ui_context_calc)::input_mask | wake_rx_mask;
+
+static auto gpio_events = spsc_ring<gpio_event, 32>{};
+
+// Only records the edges; the actions run from myb_loop.
+void gpio_irq() {
+  // We only care about edge rise; releases are told apart by the settled
+  // level in debounce_confirm.
+  auto const pins = take_gpio_irq_mask(gpio_irq_mask);
+  if (pins == 0) {
+    // No edge of ours, so nothing woke up for it.
     return;
   }
-  if (gpio == 7) {
-    wake_and_prolong_no_send();
-  } else {
-    ui_context_calc.trigger_gpio(gpio, [] { wake_and_prolong(); });
-  }
+  wake_stats.note((pins & wake_rx_mask) != 0 ? wake_source::wake_rx
+                                             : wake_source::gpio);
+  push_gpio_edges(gpio_events, pins, GPIO_IRQ_EDGE_RISE, time_us_32());
+}
+
+void debounced_dispatch::operator()(std::uint32_t pins) const {
+  // Latencies are traced from the interrupt of the first edge.
+  ui_context_calc.trigger_gpio_mask(
+      pins, [](std::size_t pin) { return debouncer.edge_stamp(pin); },
+      [] { wake_and_prolong(); });
+}
+
+void dispatch_gpio_events(steady_clock::time_point now) {
+  gpio_events.drain([&now](gpio_event const &e) {
+    if (e.pin == wake_rx_gpio) {
+      wake_and_prolong_no_send(now);
+    } else {
+      auto edge_time = from_us_timestamp(e.timestamp, now);
+      timed_queue.que(debounce_confirm_t{},
+                      debouncer.edge(e.pin, edge_time, e.timestamp));
+    }
+  });
 }
+bool has_gpio_events() { return !gpio_events.empty(); }
 
 void main() {
+  gpio_add_raw_irq_handler_masked(gpio_irq_mask, &gpio_irq);
+  irq_set_enabled(IO_IRQ_BANK0, true);
   while (1) {
 
     gpio_set_dir(wake_rx_gpio, GPIO_IN);
-    gpio_set_irq_enabled_with_callback(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true,
-                                       &gpio_irq);
+    gpio_set_irq_enabled(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true);
     gpio_set_dormant_irq_enabled(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true);
     ui_context_calc.for_each_input([](uint pin) {
       gpio_set_dir(pin, GPIO_IN);
@@ -238,7 +275,12 @@ void main() {
       now_time = steady_clock::now();
     }
 #else
-    myb_loop<steady_clock>([](auto const &tp) { return run_async_tasks(tp); });
+    myb_loop<steady_clock>(
+        [](auto const &tp) {
+          dispatch_gpio_events(tp);
+          return run_async_tasks(tp);
+        },
+        has_gpio_events);
 #endif
     sleep();
   }
@@ -6,7 +6,9 @@
 #include <concepts>
 #include <initializer_list>
 
+#include <hardware/structs/io_bank0.h>
 #include <hardware/sync.h>
+#include <hardware/timer.h>
 #include <pico/stdlib.h>
 
 #include <myb/myb.hpp>
@@ -41,9 +43,54 @@ int set_gpio_out(unsigned pin, bool value) {
   return {};
 }
 
+// Reads and acknowledges the pending GPIO interrupts of the calling core.
+// Returns one bit per pin in `pins` that has seen `event` since last call.
+std::uint32_t take_gpio_irq_mask(std::uint32_t pins,
+                                 std::uint32_t event = GPIO_IRQ_EDGE_RISE) {
+  constexpr unsigned pins_per_reg = 8;
+  constexpr unsigned bits_per_pin = 4;
+  auto &irq_ctrl = get_core_num() == 0 ? io_bank0_hw->proc0_irq_ctrl
+                                       : io_bank0_hw->proc1_irq_ctrl;
+  std::uint32_t res{};
+  for (unsigned reg = 0;
+       reg < std::size(irq_ctrl.ints) && reg * pins_per_reg < 32; ++reg) {
+    auto status = irq_ctrl.ints[reg];
+    std::uint32_t ack{};
+    for (unsigned i = 0; i < pins_per_reg; ++i) {
+      auto pin = reg * pins_per_reg + i;
+      if ((pins & (1u << pin)) != 0 &&
+          ((status >> (i * bits_per_pin)) & event) != 0) {
+        res |= 1u << pin;
+        ack |= event << (i * bits_per_pin);
+      }
+    }
+    if (ack != 0) {
+      io_bank0_hw->intr[reg] = ack;
+    }
+  }
+  return res;
+}
+
+struct time_us_source {
+  std::uint32_t operator()() const { return time_us_32(); }
+};
+// Trigger latencies in microseconds, only recorded if MYB_TRACE_LATENCY is
+// set.
+template <std::size_t slots = 32>
+using us_latency_trace = latency_trace<time_us_source, slots>;
+
+// Maps a time_us_32() timestamp taken shortly before `now` onto the clock of
+// `now`.
+template <typename TimePoint>
+TimePoint from_us_timestamp(std::uint32_t timestamp, TimePoint const &now) {
+  return now - std::chrono::microseconds(time_us_32() - timestamp);
+}
+
 template <typename T>
   requires(requires() { T::reset(); })
 struct call_static_reset {
+  // A late reset only stretches the pulse, so let it share a wakeup.
+  static constexpr auto slack = std::chrono::milliseconds(1);
   constexpr auto operator()(auto &&...) const -> decltype(T::reset()) {
     return T::reset();
   }
@@ -111,7 +158,7 @@ public:
   alarm_t &operator=(alarm_t &&other) noexcept {
     if (this != &other) {
       _do_cancel();
-      other.alarm_time = time_point::min();
+      alarm_time = std::exchange(other.alarm_time, time_point::min());
       alarm_id = other.alarm_id;
     }
     return *this;
@@ -119,44 +166,135 @@ public:
   constexpr time_point alarm_point() const { return alarm_time; }
 };
 
+// A hardware timer alarm of its own, retargeted with
+// hardware_alarm_set_target rather than allocated from the alarm pool.
+class pico_timer_alarm_hal {
+  int alarm_num_ = -1;
+
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+  bool arm(time_point const &tp) {
+    using namespace std::chrono;
+    if (alarm_num_ < 0) {
+      alarm_num_ = hardware_alarm_claim_unused(true);
+      // Only the interrupt matters, it ends the idle state.
+      hardware_alarm_set_callback(static_cast<uint>(alarm_num_), [](uint) {});
+    }
+    auto const us = static_cast<std::uint64_t>(
+        duration_cast<microseconds>(tp.time_since_epoch()).count());
+    return hardware_alarm_set_target(static_cast<uint>(alarm_num_),
+                                     from_us_since_boot(us));
+  }
+  void cancel() {
+    if (alarm_num_ >= 0) {
+      hardware_alarm_cancel(static_cast<uint>(alarm_num_));
+    }
+  }
+};
+static auto loop_alarm = retargeting_alarm<pico_timer_alarm_hal>{};
+// How late the loop alarm wakes the core, in microseconds.
+static auto alarm_wake_latency = us_latency_trace<1>{};
+
 void go_deep_sleep() { scb_hw->scr |= ARM_CPU_PREFIXED(SCR_SLEEPDEEP_BITS); }
 
 using steady_clock = std::chrono::steady_clock;
 inline constexpr auto sleep_timeout = std::chrono::minutes(5);
+// Go to sleep early rather than wake up again just for the sleep timeout.
+inline constexpr auto sleep_slack = std::chrono::seconds(1);
 static auto next_sleep = steady_clock::time_point{};
 
-template <typename Clock, std::invocable<typename Clock::time_point> AsyncTasks>
-  requires(requires(
-      std::invoke_result_t<AsyncTasks &&, typename Clock::time_point> r) {
-    { *r } -> std::convertible_to<typename Clock::time_point>;
-  })
-void myb_loop(AsyncTasks &&run_async_tasks) {
-  auto now_time = Clock::now();
-  auto alarm = alarm_t();
-  next_sleep = now_time + sleep_timeout;
-#if MYB_DEBUG
-  while (true) {
-    if (stdio_usb_connected()) {
-      fmt::print("USB Connected!\n");
+struct pico_power_hal {
+  static steady_clock::time_point now() { return steady_clock::now(); }
+  static void enter(power_state s) {
+    switch (s) {
+    case power_state::spin:
       break;
+    case power_state::wfi:
+      __wfi();
+      break;
+    case power_state::deep_sleep: {
+      // Keep SLEEPDEEP as it was, go_deep_sleep may have set it for good.
+      auto const scr = scb_hw->scr;
+      scb_hw->scr = scr | ARM_CPU_PREFIXED(SCR_SLEEPDEEP_BITS);
+      __wfi();
+      scb_hw->scr = scr;
+      break;
+    }
     }
   }
+};
+inline constexpr auto pico_power_costs =
+    power_state_costs<steady_clock::duration>{{
+        {},
+        {std::chrono::microseconds(2)},
+        {std::chrono::microseconds(50)},
+    }};
+static auto idle_power = power_scheduler(pico_power_hal{}, pico_power_costs);
+static auto wake_stats =
+    wake_accounting<wake_source, wake_source_count, steady_clock::time_point>(
+        wake_source::alarm);
+
+#if MYB_DEBUG
+inline void print_wake_report() {
+  auto buffer = std::array<char, 192>{};
+  fmt::print("{}", wake_stats.report(buffer, wake_source_names));
+}
 #endif
-  while (now_time < next_sleep) {
-    auto next_task_time = run_async_tasks(now_time);
-    if (next_task_time && *next_task_time != alarm.alarm_point()) {
-      alarm = alarm_t(*next_task_time);
-    } else if (alarm.alarm_point() != next_sleep) {
-      alarm = alarm_t(next_sleep);
+
+template <typename Clock> struct pico_loop_platform {
+  using time_point = typename Clock::time_point;
+  static time_point now() { return Clock::now(); }
+  static bool idle_until(time_point const &wake_at,
+                         std::predicate auto &&has_pending) {
+    if (!loop_alarm.set(wake_at)) {
+      // Due already, run the tasks again.
+      return false;
+    }
+    // Interrupts are masked so that work queued by an ISR after the tasks
+    // ran can not be missed; a pending IRQ still ends the idle state.
+    auto irq_state = save_and_disable_interrupts();
+    auto const idled = !has_pending();
+    if (idled) {
+      idle_power.idle(wake_at);
+    }
+    restore_interrupts(irq_state);
+    if (auto late = Clock::now() - wake_at; late >= decltype(late){}) {
+      alarm_wake_latency.record(
+          0, static_cast<std::uint32_t>(
+                 std::chrono::duration_cast<std::chrono::microseconds>(late)
+                     .count()));
     }
-    __wfi();
-    now_time = Clock::now();
 #if MYB_DEBUG
     if (!stdio_usb_connected()) {
       reset_usb_boot(0, 0);
     }
 #endif
+    return idled;
   }
+};
+
+template <typename Clock, std::invocable<typename Clock::time_point> AsyncTasks,
+          std::predicate PendingWork = no_pending_work>
+void myb_loop(AsyncTasks &&run_async_tasks, PendingWork &&has_pending = {}) {
+  next_sleep = Clock::now() + sleep_timeout;
+#if MYB_DEBUG
+  while (true) {
+    if (stdio_usb_connected()) {
+      fmt::print("USB Connected!\n");
+      break;
+    }
+  }
+#endif
+  auto platform = pico_loop_platform<Clock>{};
+  {
+    auto accounted = accounted_loop_platform(platform, wake_stats);
+    run_myb_loop(accounted, next_sleep, sleep_slack,
+                 std::forward<AsyncTasks>(run_async_tasks),
+                 std::forward<PendingWork>(has_pending));
+  }
+#if MYB_DEBUG
+  print_wake_report();
+#endif
 }
 } // namespace
 } // namespace myb
@@ -1,6 +1,8 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <thread>
 
@@ -12,6 +14,8 @@
 #include <picolinux/picolinux_libc.hpp>
 
 #include <app/myb_app.hpp>
+#include <myb/adc.hpp>
+#include <myb/led.hpp>
 #include <myb/myb.hpp>
 
 namespace myb {
@@ -28,30 +32,171 @@ template <ct_int pin> struct pico_toggle_gpio {
   }
 };
 
-template <ct_int adc_pin, std::size_t buff_size> class adc2dma {
-  std::array<std::uint16_t, buff_size * 2> tot_buff_;
-  uint dma_chan_;
-  dma_channel_config cfg_;
-  bool read_first_ = false;
-
-  static constexpr auto adc_channel = adc_pin.i - 26;
+inline dma_channel_config adc_fifo_dma_config(uint chan,
+                                              dma_channel_transfer_size size,
+                                              bool write_increment) {
+  auto cfg = dma_channel_get_default_config(chan);
+  channel_config_set_transfer_data_size(&cfg, size);
+  channel_config_set_read_increment(&cfg, false);
+  channel_config_set_write_increment(&cfg, write_increment);
+  // Pace transfers based on availability of ADC samples
+  channel_config_set_dreq(&cfg, DREQ_ADC);
+  return cfg;
+}
 
-  template <bool is_read>
-  constexpr std::span<std::uint16_t, buff_size> get_buff() {
-    if (is_read == read_first_) {
-      return std::span<std::uint16_t, buff_size>{tot_buff_.data(), buff_size};
-    } else {
-      return std::span<std::uint16_t, buff_size>{
-          tot_buff_.data() + static_cast<std::ptrdiff_t>(buff_size), buff_size};
+// One DMA channel reading the ADC FIFO, see adc_dma_hal.
+struct pico_adc_dma_hal {
+  uint chan{};
+  bool claimed{};
+  // Sink of the sniffed transfers, the samples themselves are not kept.
+  std::uint32_t scratch{};
+
+  // Called on every wake, the channel is kept across sleeps.
+  void claim() {
+    if (!std::exchange(claimed, true)) {
+      chan = dma_claim_unused_channel(true);
+      dma_channel_set_irq0_enabled(chan, true);
     }
   }
+  void start_packed(std::span<std::uint32_t> words) {
+    auto cfg = adc_fifo_dma_config(chan, DMA_SIZE_16, true);
+    dma_channel_configure(chan, &cfg,
+                          words.data(),     // dst
+                          &adc_hw->fifo,    // src
+                          words.size() * 2, // transfer count
+                          true              // start immediately
+    );
+  }
+  // Full word reads of the FIFO pop one sample each and leave the upper bits
+  // zero, so the sniffer sums the plain samples.
+  void start_sniffed(std::uint32_t transfers) {
+    auto cfg = adc_fifo_dma_config(chan, DMA_SIZE_32, false);
+    channel_config_set_sniff_enable(&cfg, true);
+    dma_sniffer_enable(chan, DMA_SNIFF_CTRL_CALC_VALUE_SUM, true);
+    dma_hw->sniff_data = 0;
+    dma_channel_configure(chan, &cfg, &scratch, &adc_hw->fifo, transfers, true);
+  }
+  static std::uint32_t sniffed_sum() { return dma_hw->sniff_data; }
+  void ack() const { dma_hw->ints0 = 1u << chan; }
+  void abort() const {
+    dma_channel_abort(chan);
+    ack();
+  }
+};
+
+// Two DMA channels reading the ADC FIFO, see chained_adc_dma_hal. In ring
+// mode the second one is the control channel that retriggers the first. In
+// ping-pong mode each one chains to a control channel of its own, which
+// writes back the start of its half and then chains to the other one.
+struct pico_chained_adc_dma_hal {
+  std::array<uint, 2> chans{};
+  std::array<uint, 2> reloads{};
+  bool claimed{};
+  bool reloads_claimed{};
+  // Read by the control channels.
+  std::array<std::uint32_t *, 2> half_starts{};
+  std::uint32_t ring_block{};
+  std::uintptr_t ring_base{};
+  std::uint32_t ring_samples{};
+
+  std::uint32_t irq_mask() const {
+    return (1u << chans[0]) | (1u << chans[1]);
+  }
 
-  constexpr std::span<std::uint16_t, buff_size> write_buff() {
-    return get_buff<false>();
+  void claim() {
+    if (!std::exchange(claimed, true)) {
+      for (auto &c : chans) {
+        c = dma_claim_unused_channel(true);
+      }
+    }
+  }
+  void start_ping_pong(std::span<std::uint32_t> first,
+                       std::span<std::uint32_t> second) {
+    // Only ping-pong needs the control channels.
+    if (!std::exchange(reloads_claimed, true)) {
+      for (auto &c : reloads) {
+        c = dma_claim_unused_channel(true);
+      }
+    }
+    auto const halves = std::array{first, second};
+    // The second channel first, so that it is ready when the first chains.
+    for (std::size_t i = 2; i-- > 0;) {
+      half_starts[i] = halves[i].data();
+      auto ctrl = dma_channel_get_default_config(reloads[i]);
+      channel_config_set_transfer_data_size(&ctrl, DMA_SIZE_32);
+      channel_config_set_read_increment(&ctrl, false);
+      channel_config_set_write_increment(&ctrl, false);
+      channel_config_set_chain_to(&ctrl, chans[i ^ 1]);
+      // The plain write address, which does not trigger the channel.
+      dma_channel_configure(reloads[i], &ctrl, &dma_hw->ch[chans[i]].write_addr,
+                            &half_starts[i], 1, false);
+      auto cfg = adc_fifo_dma_config(chans[i], DMA_SIZE_16, true);
+      channel_config_set_chain_to(&cfg, reloads[i]);
+      dma_channel_configure(chans[i], &cfg, halves[i].data(), &adc_hw->fifo,
+                            halves[i].size() * 2, i == 0);
+      dma_channel_set_irq0_enabled(chans[i], true);
+    }
+  }
+  void start_ring(std::span<std::uint32_t> buffer, std::uint32_t block) {
+    ring_block = block;
+    ring_base = reinterpret_cast<std::uintptr_t>(buffer.data());
+    ring_samples = static_cast<std::uint32_t>(buffer.size() * 2);
+    auto ctrl = dma_channel_get_default_config(chans[1]);
+    channel_config_set_transfer_data_size(&ctrl, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl, false);
+    channel_config_set_write_increment(&ctrl, false);
+    dma_channel_configure(chans[1], &ctrl,
+                          &dma_hw->ch[chans[0]].al1_transfer_count_trig,
+                          &ring_block, 1, false);
+    dma_channel_set_irq0_enabled(chans[1], false);
+    auto data = adc_fifo_dma_config(chans[0], DMA_SIZE_16, true);
+    channel_config_set_ring(&data, true,
+                            static_cast<uint>(std::countr_zero(
+                                buffer.size_bytes())));
+    channel_config_set_chain_to(&data, chans[1]);
+    dma_channel_configure(chans[0], &data, buffer.data(), &adc_hw->fifo,
+                          block, true);
+    dma_channel_set_irq0_enabled(chans[0], true);
+  }
+  std::uint32_t take_completed() const {
+    auto const ints = dma_hw->ints0 & irq_mask();
+    dma_hw->ints0 = ints;
+    return ((ints >> chans[0]) & 1u) | (((ints >> chans[1]) & 1u) << 1);
+  }
+  std::size_t ring_position() const {
+    auto const written = dma_hw->ch[chans[0]].write_addr - ring_base;
+    return (written / 2) % ring_samples;
+  }
+  static bool take_fifo_overflow() {
+    if ((adc_hw->fcs & ADC_FCS_OVER_BITS) == 0) {
+      return false;
+    }
+    // Write one to clear.
+    hw_set_bits(&adc_hw->fcs, ADC_FCS_OVER_BITS);
+    return true;
   }
-  constexpr std::span<std::uint16_t, buff_size> read_buff() {
-    return get_buff<true>();
+  void abort() const {
+    for (auto c : chans) {
+      dma_channel_abort(c);
+    }
+    if (reloads_claimed) {
+      for (auto c : reloads) {
+        dma_channel_abort(c);
+      }
+    }
+    dma_hw->ints0 = irq_mask();
   }
+};
+
+// Capture is adc_dma_capture or adc_chained_capture over the HALs above.
+// Channels is an adc_channel_list; with more than one input the ADC samples
+// them round-robin and the filter should be an adc_channels.
+// Converts at the full rate on adc_rate::burst and at background_rate,
+// per input, otherwise.
+template <typename Channels, typename Capture,
+          std::uint32_t background_rate = adc_max_rate>
+class adc2dma {
+  Capture capture_;
 
 public:
   // simply because the buffer must be in memory. Could be other ways to do
@@ -64,11 +209,17 @@ public:
 
     adc_init();
 
-    // Make sure GPIO is high-impedance, no pullups etc
-    adc_gpio_init(adc_pin.i);
-    // Select ADC input 0 (GPIO26)
-    adc_select_input(adc_channel);
-    adc_set_clkdiv(0);
+    for (auto input : Channels::list) {
+      if (input < 4) {
+        // Make sure GPIO is high-impedance, no pullups etc
+        adc_gpio_init(26 + input);
+      }
+    }
+    adc_set_temp_sensor_enabled(Channels::has_temperature);
+    // The round robin goes up from the selected input.
+    adc_select_input(Channels::first);
+    adc_set_round_robin(Channels::size > 1 ? Channels::round_robin_mask : 0);
+    set_rate(adc_rate::burst);
     adc_fifo_setup(
         true,  // Write each completed conversion to the sample FIFO
         true,  // Enable DMA data request (DREQ)
@@ -77,45 +228,27 @@ public:
         false  // Shift each sample to 8 bits when pushing to FIFO
     );
 
-    dma_chan_ = dma_claim_unused_channel(true);
-    cfg_ = dma_channel_get_default_config(dma_chan_);
-
-    // Reading from constant address, writing to incrementing byte addresses
-    channel_config_set_transfer_data_size(&cfg_, DMA_SIZE_16);
-    channel_config_set_read_increment(&cfg_, false);
-    channel_config_set_write_increment(&cfg_, true);
-
-    // Pace transfers based on availability of ADC samples
-    channel_config_set_dreq(&cfg_, DREQ_ADC);
-
-    auto capture_buf = write_buff();
-    dma_channel_configure(dma_chan_, &cfg_,
-                          capture_buf.data(), // dst
-                          &adc_hw->fifo,      // src
-                          capture_buf.size(), // transfer count
-                          true                // start immediately
-    );
-    dma_channel_set_irq0_enabled(dma_chan_, true);
+    capture_.hal().claim();
+    capture_.start();
     adc_run(true);
   }
-  bool is_adc_ready() { return !dma_channel_is_busy(dma_chan_); }
-  auto read_averaged_adc() {
-    read_first_ = !read_first_;
-    auto to_read = read_buff();
-    auto capture_buf = write_buff();
-    dma_channel_configure(dma_chan_, &cfg_,
-                          capture_buf.data(), // dst
-                          &adc_hw->fifo,      // src
-                          capture_buf.size(), // transfer count
-                          true                // start immediately
-    );
-    dma_hw->ints0 = 1u << dma_chan_;
-    auto res_sum =
-        std::ranges::fold_left(to_read, std::int_fast32_t{}, std::plus<>{});
-    return res_sum / buff_size;
+  /// Takes the completed block and runs it through the filter.
+  template <typename Pipeline> auto read_filtered(Pipeline &filter) {
+    return capture_.take(filter);
+  }
+  Capture const &capture() const { return capture_; }
+  /// Takes effect from the next conversion, the DMA keeps running.
+  void set_rate(adc_rate r) {
+    adc_set_clkdiv(r == adc_rate::burst
+                       ? adc_clkdiv(adc_max_rate)
+                       : adc_clkdiv(background_rate * Channels::size));
   }
   void sleep() {
     adc_run(false);
+    // The channels are kept across sleeps. Stopped partway through a block
+    // they would ignore the restart on wake and finish a short block.
+    capture_.hal().abort();
+    adc_set_temp_sensor_enabled(false);
     adc_fifo_drain();
   }
 };
@@ -124,15 +257,21 @@ template <ct_int pin, uint resolution>
   requires(resolution > 1)
 class pwm_led_fader {
 public:
-  static void init() {
+  // As pwm_gpio_to_channel.
+  static constexpr uint channel = pin.i % 2;
+  // Slice clock cycles per wrap.
+  static constexpr uint cycles = resolution;
+
+  // A clkdiv above 1 slows down the wraps, which pace pwm_dma_player.
+  static void init(float clkdiv = 1.f) {
     gpio_set_function(pin.i, GPIO_FUNC_PWM);
 
     // Find out which PWM slice is connected to GPIO pin
     uint slice_num = pwm_gpio_to_slice_num(pin.i);
-    uint channel = pwm_gpio_to_channel(pin.i);
 
     // Set period of resolution cycles (is inclusive)
     pwm_set_wrap(slice_num, resolution - 1);
+    pwm_set_clkdiv(slice_num, clkdiv);
     // Set channel A output high for one cycle before dropping
     pwm_set_chan_level(slice_num, channel, 1);
     // Set the PWM running
@@ -140,7 +279,6 @@ public:
   }
   static void set_level(uint l) {
     uint slice_num = pwm_gpio_to_slice_num(pin.i);
-    uint channel = pwm_gpio_to_channel(pin.i);
     pwm_set_chan_level(slice_num, channel, l);
   }
   static void sleep() {
@@ -149,6 +287,64 @@ public:
   }
 };
 
+// One DMA channel writing the compare register of the PWM slice of pin on
+// each wrap of the slice, see pwm_dma_hal.
+template <ct_int pin> struct pico_pwm_dma_hal {
+  uint chan{};
+  bool claimed{};
+  std::uintptr_t base{};
+
+  static uint slice() { return pwm_gpio_to_slice_num(pin.i); }
+  void claim() {
+    if (!std::exchange(claimed, true)) {
+      chan = dma_claim_unused_channel(true);
+    }
+  }
+  dma_channel_config config() const {
+    auto cfg = dma_channel_get_default_config(chan);
+    // The whole register, see pwm_cc_word.
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, DREQ_PWM_WRAP0 + slice());
+    return cfg;
+  }
+  void start(std::span<std::uint32_t const> words) {
+    claim();
+    base = reinterpret_cast<std::uintptr_t>(words.data());
+    auto cfg = config();
+    dma_channel_configure(chan, &cfg, &pwm_hw->slice[slice()].cc,
+                          words.data(), words.size(), true);
+  }
+  void start_ring(std::span<std::uint32_t const> words) {
+    claim();
+    base = reinterpret_cast<std::uintptr_t>(words.data());
+    auto cfg = config();
+    channel_config_set_ring(&cfg, false,
+                            std::countr_zero(words.size_bytes()));
+    // 2^32 - 1 wraps last hours even at the fastest wrap rate.
+    dma_channel_configure(chan, &cfg, &pwm_hw->slice[slice()].cc,
+                          words.data(), 0xffffffffu, true);
+  }
+  bool busy() const { return claimed && dma_channel_is_busy(chan); }
+  std::size_t position() const {
+    return claimed ? (dma_channel_hw_addr(chan)->read_addr - base) / 4 : 0;
+  }
+  void stop() {
+    if (claimed) {
+      dma_channel_abort(chan);
+    }
+  }
+};
+
+// led_animator output with channel i going to the i:th fader.
+template <typename... Faders> struct pwm_fader_out {
+  void operator()(std::size_t channel, std::uint16_t level) const {
+    std::size_t i{};
+    ((i++ == channel ? Faders::set_level(level) : void()), ...);
+  }
+};
+
 template <ct_int redp, ct_int yellowp, ct_int greenp>
 struct static_traffic_lights_out {
   static void init() noexcept {
@@ -189,11 +385,57 @@ inline constexpr uint wake_rx_gpio = 7u;
 
 static auto wake_other = rxtx_wake_interrupt<wake_tx_gpio>();
 
+inline constexpr auto debounce_settle = std::chrono::milliseconds(5);
+static auto debouncer =
+    gpio_debouncer<steady_clock::time_point>(debounce_settle);
+struct debounced_dispatch {
+  void operator()(std::uint32_t pins) const;
+};
+using debounce_confirm_t =
+    debounce_confirm<decltype([]() -> auto & { return debouncer; }),
+                     debounced_dispatch,
+                     decltype([] { return gpio_get_all(); })>;
+
+// The knob sets the brightness in lightness; level changes fade in over
+// 100ms. The fade is either played by DMA, a word per wrap of the LED
+// slice, or stepped by led_animator at 50Hz. For DMA, the slice clock is
+// divided by 255 so that it wraps about 1.9k times a second.
+inline constexpr uint led_resolution = 256;
+using the_fader_t = pwm_led_fader<25, led_resolution>;
+inline constexpr auto led_lut = cie_lut<led_lightness_steps, led_resolution>();
+inline constexpr auto led_tick = std::chrono::milliseconds(20);
+inline constexpr auto led_fade_time = std::chrono::milliseconds(100);
+inline constexpr bool led_fades_by_dma = true;
+// The default system clock, which the wrap rate follows.
+inline constexpr std::uint32_t led_sys_clk_hz = 125'000'000;
+inline constexpr std::uint32_t led_pwm_divider = led_fades_by_dma ? 255 : 1;
+inline constexpr float led_pwm_clkdiv = led_pwm_divider;
+inline constexpr std::uint32_t led_wrap_hz =
+    led_sys_clk_hz / (led_pwm_divider * the_fader_t::cycles);
+// A word per wrap; none are needed when led_animator fades.
+inline constexpr std::size_t led_fade_word_count =
+    led_fades_by_dma ? led_wrap_hz * led_fade_time.count() / 1000 : 0;
+static_assert(led_pwm_clkdiv == led_pwm_divider && led_pwm_divider <= 255,
+              "An integer clkdiv the slice divider takes as is");
+static_assert(!led_fades_by_dma || led_fade_word_count > 0);
+static auto led_fade_words = std::array<std::uint32_t, led_fade_word_count>{};
+static auto led_player = pwm_dma_player<pico_pwm_dma_hal<25>>{};
+// The fade led_player plays, in lightness.
+static auto led_dma_from = std::uint8_t{};
+static auto led_dma_to = std::uint8_t{};
+static auto leds =
+    led_animator<steady_clock::time_point, 1, pwm_fader_out<the_fader_t>>(
+        led_lut, led_tick);
+using led_step_t =
+    led_animation_step<decltype([]() -> auto & { return leds; })>;
+
 static auto timed_queue = typed_time_queue(
-    steady_clock::time_point{}, call_static_reset<decltype(wake_other)>{});
+    steady_clock::time_point{}, call_static_reset<decltype(wake_other)>{},
+    debounce_confirm_t{}, led_step_t{});
 
 static auto context =
     ui_context::builder()
+        .trace<us_latency_trace<>>()
         .gpios(                                     //
             gpio_sel<8> >> pico_toggle_gpio<9>(),   //> red
             gpio_sel<10> >> pico_toggle_gpio<11>(), //> green
@@ -203,8 +445,18 @@ static auto context =
             )
         .build();
 
-static auto the_adc = adc2dma<26, 512>{};
-using the_fader_t = pwm_led_fader<25, 256>;
+// The sniffer sums each block during the transfer, so the DMA IRQ only
+// runs the rest of the filter. adc_chained_capture keeps the DMA running
+// between blocks instead, but sums on the CPU.
+//
+// While the knob is still, a block every 64ms is plenty; on movement it
+// bursts at the full rate, a block every millisecond.
+inline constexpr std::size_t adc_block = 512;
+inline constexpr std::uint32_t adc_background_rate = 8'000;
+using adc_capture_t =
+    adc_dma_capture<pico_adc_dma_hal, adc_block, adc_averaging::sniffer>;
+static auto the_adc =
+    adc2dma<adc_channel_list<0>, adc_capture_t, adc_background_rate>{};
 
 void wake_and_prolong_no_send(steady_clock::time_point now) {
   wake_other.init();
@@ -220,41 +472,140 @@ void wake_and_prolong() {
 void sleep() {
   context.sleep();
   the_adc.sleep();
+  led_player.stop();
   the_fader_t::sleep();
   go_deep_sleep();
 }
 
-void gpio_irq(uint gpio, std::uint32_t events) {
-  constexpr std::uint32_t edge_rise_mask = 0b1000u;
-  // We only care about edge rise.
-  if ((events & edge_rise_mask) == 0) {
+inline constexpr std::uint32_t wake_rx_mask = 1u << wake_rx_gpio;
+inline constexpr std::uint32_t gpio_irq_mask =
+    decltype(context)::input_mask | wake_rx_mask;
+
+static auto gpio_events = spsc_ring<gpio_event, 32>{};
+
+// Only records the edges; the actions run from myb_loop.
+void gpio_irq() {
+  // We only care about edge rise; releases are told apart by the settled
+  // level in debounce_confirm.
+  auto const pins = take_gpio_irq_mask(gpio_irq_mask);
+  if (pins == 0) {
+    // No edge of ours, so nothing woke up for it.
     return;
   }
-  if (gpio == 7) {
-    wake_and_prolong_no_send();
+  wake_stats.note((pins & wake_rx_mask) != 0 ? wake_source::wake_rx
+                                             : wake_source::gpio);
+  push_gpio_edges(gpio_events, pins, GPIO_IRQ_EDGE_RISE, time_us_32());
+}
+
+void debounced_dispatch::operator()(std::uint32_t pins) const {
+  // Latencies are traced from the interrupt of the first edge.
+  context.trigger_gpio_mask(
+      pins, [](std::size_t pin) { return debouncer.edge_stamp(pin); },
+      [] { wake_and_prolong(); });
+}
+
+void dispatch_gpio_events(steady_clock::time_point now) {
+  gpio_events.drain([&now](gpio_event const &e) {
+    if (e.pin == wake_rx_gpio) {
+      wake_and_prolong_no_send(now);
+    } else {
+      auto edge_time = from_us_timestamp(e.timestamp, now);
+      timed_queue.que(debounce_confirm_t{},
+                      debouncer.edge(e.pin, edge_time, e.timestamp));
+    }
+  });
+}
+bool has_gpio_events() { return !gpio_events.empty(); }
+static auto adc_filter = [] {
+  if constexpr (adc_capture_t::averaging == adc_averaging::cpu) {
+    return adc_pipeline(boxcar<adc_block>{}, ema<2>{});
   } else {
-    context.trigger_gpio(gpio, [] { wake_and_prolong(); });
+    return adc_pipeline(ema<2>{});
   }
-}
-static auto old_adc_value = decltype(the_adc.read_averaged_adc()){};
+}();
+// A knob turn has to hold for 20ms before sleep is postponed, drift of up
+// to 20 steps a second is ignored, and the burst lasts until the value has
+// been still for half a second.
+inline constexpr auto adc_activity_dwell = std::chrono::milliseconds(20);
+inline constexpr auto adc_drift_step = std::chrono::milliseconds(50);
+inline constexpr auto adc_burst_hold = std::chrono::milliseconds(500);
+static auto knob_change = adc_change_detector<steady_clock::time_point>(
+    16, 16, adc_activity_dwell, adc_drift_step);
+static auto adc_rate_control =
+    adc_rate_controller<steady_clock::time_point>(adc_burst_hold);
+static auto dma_irq_rate = per_second_counter<steady_clock::time_point>{};
+// Lightness for the LED from dma_irq, or -1; the fade starts from myb_loop.
+static auto adc_lightness = std::atomic<std::int32_t>{-1};
+static auto dma_irq_latency = us_latency_trace<1>{};
 
 void dma_irq() {
-  auto v = the_adc.read_averaged_adc();
+  wake_stats.note(wake_source::dma);
+  auto const started = dma_irq_latency.start();
+  auto const filtered = the_adc.read_filtered(adc_filter);
+  if (!filtered) {
+    // Overrun of a chained capture, nothing new to show.
+    dma_irq_latency.finish(0, started);
+    return;
+  }
+  auto const now = steady_clock::now();
+  dma_irq_rate.note(now);
+  auto const change = knob_change.push(*filtered, now);
+  if (auto rate = adc_rate_control.push(change, now)) {
+    the_adc.set_rate(*rate);
+  }
 #if MYB_DEBUG
-  fmt::print("Averaged ADC value is {}\n", v);
+  fmt::print("Averaged ADC value is {}, {} suppressed, {} irq/s\n", *filtered,
+             knob_change.suppressed(), dma_irq_rate.per_second());
 #endif
-  if (static_cast<unsigned>(v - old_adc_value) >= 32) {
-    next_sleep = steady_clock::now() + sleep_timeout;
-    old_adc_value = v;
+  if (change.activity) {
+    next_sleep = now + sleep_timeout;
+  }
+  if (change.update) {
+    adc_lightness.store(std::clamp(knob_change.output() >> 4, 0, 255),
+                        std::memory_order_relaxed);
+  }
+  dma_irq_latency.finish(0, started);
+}
+
+std::uint8_t led_dma_lightness() {
+  // A stopped fade counts as done; the read address is left where it
+  // stopped.
+  if (!led_player.playing()) {
+    return led_dma_to;
   }
-  the_fader_t::set_level(v >> 4);
+  auto const n = static_cast<std::int32_t>(led_fade_words.size());
+  auto const i = static_cast<std::int32_t>(led_player.position());
+  return static_cast<std::uint8_t>(led_dma_from +
+                                   (led_dma_to - led_dma_from) * i / n);
+}
+void fade_to_adc_lightness(steady_clock::time_point now) {
+  auto const l = adc_lightness.exchange(-1, std::memory_order_relaxed);
+  if (l < 0) {
+    return;
+  }
+  if constexpr (led_fades_by_dma) {
+    // The words are rewritten, so the fade must stop first.
+    led_dma_from = led_dma_lightness();
+    led_player.stop();
+    led_dma_to = static_cast<std::uint8_t>(l);
+    pwm_fade_words(led_fade_words, led_lut, led_dma_from, led_dma_to,
+                   the_fader_t::channel);
+    led_player.play(led_fade_words);
+  } else {
+    leds.fade(0, static_cast<std::uint8_t>(l), led_fade_time, now);
+    timed_queue.que(led_step_t{}, now);
+  }
+}
+bool has_adc_lightness() {
+  return adc_lightness.load(std::memory_order_relaxed) >= 0;
 }
 
 void main() {
+  gpio_add_raw_irq_handler_masked(gpio_irq_mask, &gpio_irq);
+  irq_set_enabled(IO_IRQ_BANK0, true);
   while (1) {
     gpio_set_dir(wake_rx_gpio, GPIO_IN);
-    gpio_set_irq_enabled_with_callback(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true,
-                                       &gpio_irq);
+    gpio_set_irq_enabled(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true);
     gpio_set_dormant_irq_enabled(wake_rx_gpio, GPIO_IRQ_EDGE_RISE, true);
     context.for_each_input([](uint pin) {
       gpio_set_dir(pin, GPIO_IN);
@@ -264,11 +615,23 @@ void main() {
     irq_set_exclusive_handler(DMA_IRQ_0, &dma_irq);
     irq_set_enabled(DMA_IRQ_0, true);
     the_adc.init();
-    the_fader_t::init();
-    myb_loop<steady_clock>([](auto const &tp) {
-      timed_queue.execute_all(tp);
-      return timed_queue.next();
-    });
+    adc_rate_control.restart(adc_rate::burst, steady_clock::now());
+    the_fader_t::init(led_pwm_clkdiv);
+    if constexpr (led_fades_by_dma) {
+      led_dma_from = led_dma_to;
+      the_fader_t::set_level(led_lut[led_dma_to]);
+    } else {
+      leds.invalidate();
+      timed_queue.que(led_step_t{}, steady_clock::now());
+    }
+    myb_loop<steady_clock>(
+        [](auto const &tp) {
+          dispatch_gpio_events(tp);
+          fade_to_adc_lightness(tp);
+          timed_queue.execute_all(tp);
+          return timed_queue.next();
+        },
+        [] { return has_gpio_events() || has_adc_lightness(); });
     sleep();
   }
 }
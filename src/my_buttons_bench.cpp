@@ -0,0 +1,544 @@
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <myb/adc.hpp>
+#include <myb/myb.hpp>
+#include <myb/sim.hpp>
+#include <myb/task.hpp>
+
+namespace myb {
+inline namespace {
+struct bench_counter_action {
+  std::uint32_t *count;
+  constexpr void trigger() noexcept { ++*count; }
+  static constexpr void on_sleep() noexcept {}
+  static constexpr void on_wake() noexcept {}
+};
+
+template <typename F> double ns_per_call(std::size_t iterations, F &&f) {
+  using namespace std::chrono;
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    f(i);
+  }
+  auto end = steady_clock::now();
+  return duration<double, std::nano>(end - start).count() /
+         static_cast<double>(iterations);
+}
+
+inline constexpr std::size_t bench_iterations = 1u << 24;
+
+// SIO output register of a GPIO bank, counting writes and the values the
+// pins showed in between two updates.
+struct bench_gpio_hal {
+  std::uint32_t out{};
+  std::uint32_t calls{};
+  std::uint32_t intermediate{};
+  std::uint32_t from{};
+  std::uint32_t to{};
+
+  void note() {
+    ++calls;
+    intermediate += out != from && out != to;
+  }
+  void put(unsigned pin, bool value) {
+    out = value ? out | (1u << pin) : out & ~(1u << pin);
+    note();
+  }
+  void put_masked(std::uint32_t mask, std::uint32_t value) {
+    out = (out & ~mask) | (value & mask);
+    note();
+  }
+};
+
+// Every update between two values of the result bus of the 3bit calculator,
+// with a gpio_put per pin as led_binary_out did, or one masked write.
+template <int... pins> void bench_led_binary_out() {
+  using scatter = gpio_bit_scatter<pins...>;
+  constexpr std::uint32_t values = 1u << sizeof...(pins);
+  auto run = [](auto &&write) {
+    auto hal = bench_gpio_hal{};
+    std::uint32_t updates{};
+    for (std::uint32_t a = 0; a < values; ++a) {
+      for (std::uint32_t b = 0; b < values; ++b, ++updates) {
+        hal.out = hal.from = scatter::scatter(a);
+        hal.to = scatter::scatter(b);
+        write(hal, std::bitset<sizeof...(pins)>(b));
+      }
+    }
+    return std::pair{static_cast<double>(hal.calls) / updates,
+                     static_cast<double>(hal.intermediate) / updates};
+  };
+  auto const per_pin = run([](bench_gpio_hal &hal, auto const &bits) {
+    std::size_t i{};
+    (hal.put(pins, bits[i++]), ...);
+  });
+  auto const masked = run([](bench_gpio_hal &hal, auto const &bits) {
+    hal.put_masked(scatter::mask, scatter::scatter(bits));
+  });
+  fmt::print("led_binary_out {} pins: per pin {:.1f} calls, {:.2f} glitches; "
+             "masked {:.1f} calls, {:.2f} glitches per update\n",
+             sizeof...(pins), per_pin.first, per_pin.second, masked.first,
+             masked.second);
+}
+
+template <std::size_t pin_count> void bench_gpio_dispatch() {
+  std::uint32_t count{};
+  auto ui = [&count]<std::size_t... is>(std::index_sequence<is...>) {
+    return ui_context::builder()
+        .gpios((gpio_sel<is> >> bench_counter_action{&count})...)
+        .build();
+  }(std::make_index_sequence<pin_count>{});
+  auto rng = std::minstd_rand{};
+  auto pins = std::array<unsigned, 1024>{};
+  for (auto &p : pins) {
+    p = static_cast<unsigned>(rng() % pin_count);
+  }
+  constexpr auto pin_mask = pins.size() - 1;
+  auto fold_ns = ns_per_call(bench_iterations, [&](std::size_t i) {
+    ui.template trigger_gpio<gpio_dispatch::fold>(pins[i & pin_mask]);
+  });
+  auto table_ns = ns_per_call(bench_iterations, [&](std::size_t i) {
+    ui.template trigger_gpio<gpio_dispatch::table>(pins[i & pin_mask]);
+  });
+  fmt::print("trigger_gpio {:>2} pins: fold {:6.2f} ns, table {:6.2f} ns "
+             "({} triggers)\n",
+             pin_count, fold_ns, table_ns, count);
+}
+
+// The typed_time_queue scan from before the tournament tree, as reference.
+template <typename TimePoint, typename... Ts>
+class linear_time_queue : dtl::empty_structs_optimiser<Ts...> {
+  using _base_t = dtl::empty_structs_optimiser<Ts...>;
+  static constexpr auto q_size = sizeof...(Ts);
+  std::array<TimePoint, q_size> time_points_ = [] {
+    std::array<TimePoint, q_size> res{};
+    std::ranges::fill(res, TimePoint::max());
+    return res;
+  }();
+  using ts_type_erase =
+      std::add_pointer_t<void(linear_time_queue &, TimePoint const &)>;
+  template <typename T>
+  static constexpr auto type_index_v =
+      dtl::tuple_element_index_v<T, std::tuple<Ts...>>;
+  static constexpr std::array<ts_type_erase, q_size> ts_callbacks = {
+      [](linear_time_queue &q, TimePoint const &tp) {
+        get<type_index_v<Ts>>(static_cast<_base_t &>(q))(q, tp);
+      }...};
+
+public:
+  constexpr std::optional<TimePoint> next() {
+    if (auto val = std::ranges::min_element(time_points_);
+        *val < TimePoint::max()) {
+      return *val;
+    }
+    return std::nullopt;
+  }
+  constexpr int execute_all(TimePoint const &tp) {
+    int count{};
+    while (true) {
+      auto lowest = std::ranges::min_element(time_points_);
+      auto cur_tp = *lowest;
+      if (cur_tp <= tp) {
+        ++count;
+        *lowest = TimePoint::max();
+        auto index = std::ranges::distance(begin(time_points_), lowest);
+        ts_callbacks[index](*this, cur_tp);
+      } else {
+        return count;
+      }
+    }
+  }
+  template <typename T> constexpr void que(T const &, TimePoint tp) {
+    time_points_[type_index_v<T>] = tp;
+  }
+};
+
+using bench_time_point = std::chrono::steady_clock::time_point;
+
+// Requeues itself with a period that differs per timer type, so that
+// several timers expire together on most steps.
+template <std::size_t i> struct periodic_bench_timer {
+  constexpr void operator()(auto &q, bench_time_point const &tp) const {
+    q.que(*this, tp + std::chrono::microseconds(100 * (i % 7 + 1)));
+  }
+};
+
+template <typename Queue>
+void print_ns_per_wakeup(std::string_view name, Queue &q, std::size_t steps) {
+  using namespace std::chrono;
+  auto now = bench_time_point{};
+  std::size_t expired{};
+  auto next = std::optional<bench_time_point>{};
+  auto ns = ns_per_call(steps, [&](std::size_t) {
+    now += microseconds(100);
+    expired += static_cast<std::size_t>(q.execute_all(now));
+    next = q.next();
+  });
+  fmt::print("  {:<16}{:8.2f} ns/wakeup ({} expired, last next {} us)\n", name,
+             ns, expired,
+             duration_cast<microseconds>(next->time_since_epoch()).count());
+}
+
+template <std::size_t timer_count> void bench_time_queue() {
+  constexpr std::size_t steps = 1u << 18;
+  auto run = [&]<template <typename, typename...> class Q, std::size_t... is>(
+                 std::string_view name, std::index_sequence<is...>) {
+    auto q = Q<bench_time_point, periodic_bench_timer<is>...>{};
+    (q.que(periodic_bench_timer<is>{}, bench_time_point{}), ...);
+    print_ns_per_wakeup(name, q, steps);
+  };
+  fmt::print("time queue {} timers:\n", timer_count);
+  run.template operator()<linear_time_queue>(
+      "linear scan", std::make_index_sequence<timer_count>{});
+  run.template operator()<typed_time_queue>(
+      "tournament tree", std::make_index_sequence<timer_count>{});
+}
+
+// Runtime timers that requeue themselves with a random period of up to one
+// second, so that the wheel holds timer_count deadlines at all times.
+template <std::size_t timer_count> void bench_timing_wheel() {
+  using namespace std::chrono;
+  auto rng = std::minstd_rand{};
+  auto requeue = [&rng](auto &wheel, std::size_t id, bench_time_point tp) {
+    wheel.que(id, tp + milliseconds(1 + rng() % 1000));
+  };
+  using wheel_t = timing_wheel<bench_time_point, milliseconds, timer_count,
+                               decltype(requeue)>;
+  // The node pool is too large for the stack with 10k timers.
+  static auto wheel = std::optional<wheel_t>{};
+  wheel.emplace(bench_time_point{}, requeue);
+  auto periods = std::array<milliseconds, 1024>{};
+  for (auto &p : periods) {
+    p = milliseconds(1 + rng() % 1000);
+  }
+  constexpr auto period_mask = periods.size() - 1;
+  auto que_ns = ns_per_call(timer_count, [&](std::size_t i) {
+    wheel->que(i, bench_time_point{} + periods[i & period_mask]);
+  });
+  auto unque_ns = ns_per_call(timer_count, [&](std::size_t i) {
+    wheel->unque(timer_count - 1 - i);
+  });
+  for (std::size_t i = 0; i < timer_count; ++i) {
+    wheel->que(i, bench_time_point{} + periods[i & period_mask]);
+  }
+  constexpr std::size_t steps = 1u << 16;
+  auto now = bench_time_point{};
+  std::size_t expired{};
+  auto next = std::optional<bench_time_point>{};
+  auto step_ns = ns_per_call(steps, [&](std::size_t) {
+    now += milliseconds(1);
+    expired += static_cast<std::size_t>(wheel->execute_all(now));
+    next = wheel->next();
+  });
+  fmt::print("timing wheel {} timers: que {:6.2f} ns, unque {:6.2f} ns, "
+             "{:8.2f} ns/wakeup ({:.1f} expired per wakeup)\n",
+             timer_count, que_ns, unque_ns, step_ns,
+             static_cast<double>(expired) / static_cast<double>(steps));
+}
+
+// A wake pulse that repeats forever, written as a callback that requeues
+// itself in two steps and as a coroutine.
+struct callback_pulse {
+  std::uint32_t *pin;
+  constexpr void operator()(auto &q, bench_time_point const &tp) const {
+    using namespace std::chrono;
+    *pin ^= 1;
+    q.que(*this, tp + (*pin != 0 ? microseconds(100) : milliseconds(1)));
+  }
+};
+struct co_bench_pulse_tag {};
+using co_bench_pulse = co_slot<co_bench_pulse_tag>;
+co_task<bench_time_point> co_pulse(co_bench_pulse, std::uint32_t *pin) {
+  using namespace std::chrono;
+  for (;;) {
+    *pin = 1;
+    co_await sleep_for(microseconds(100));
+    *pin = 0;
+    co_await sleep_for(milliseconds(1));
+  }
+}
+
+void bench_co_task() {
+  constexpr std::size_t steps = 1u << 22;
+  auto run = [](auto &q, std::uint32_t const &pin) {
+    auto now = bench_time_point{};
+    std::uint32_t high{};
+    auto ns = ns_per_call(steps, [&](std::size_t) {
+      now = *q.next();
+      q.execute_all(now);
+      high += pin;
+    });
+    return std::pair(ns, high);
+  };
+  std::uint32_t cb_pin{};
+  auto cb_q = typed_time_queue(bench_time_point{}, callback_pulse{&cb_pin});
+  cb_q.que(callback_pulse{&cb_pin}, bench_time_point{});
+  auto [cb_ns, cb_high] = run(cb_q, cb_pin);
+  std::uint32_t co_pin{};
+  auto co_q = typed_time_queue(bench_time_point{}, co_bench_pulse{});
+  co_bench_pulse::start(co_q, co_pulse({}, &co_pin), bench_time_point{});
+  auto [co_ns, co_high] = run(co_q, co_pin);
+  co_bench_pulse::stop(co_q);
+  fmt::print("pulse task: callback requeue {:6.2f} ns/step, coroutine {:6.2f} "
+             "ns/step ({} and {} high)\n",
+             cb_ns, co_ns, cb_high, co_high);
+}
+
+// Time stamp counter ticks where the host has one, zero elsewhere.
+std::uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// One DMA buffer of adc2dma<26, 512>, filtered as the DMA IRQ would.
+void bench_adc_filters() {
+  constexpr std::size_t samples = 512;
+  constexpr std::size_t buffers = 1u << 14;
+  auto rng = std::minstd_rand{};
+  auto plain = std::array<std::uint16_t, samples>{};
+  for (auto &v : plain) {
+    v = static_cast<std::uint16_t>(rng() % 4096);
+  }
+  auto packed = std::array<std::uint32_t, samples / 2>{};
+  for (std::size_t i = 0; i < packed.size(); ++i) {
+    packed[i] = plain[2 * i] | (std::uint32_t{plain[2 * i + 1]} << 16);
+  }
+  auto report = [&](std::string_view name, auto &&per_buffer) {
+    std::int64_t sink{};
+    auto const cycles_before = bench_cycles();
+    auto ns = ns_per_call(buffers, [&](std::size_t i) {
+      // Keeps the compiler from hoisting the work out of the loop.
+      plain[i % samples] ^= 1;
+      packed[i % packed.size()] ^= 1;
+      sink += per_buffer();
+    });
+    auto const cycles = bench_cycles() - cycles_before;
+    fmt::print("  {:<20}{:7.3f} ns/sample, {:6.3f} cycles/sample ({})\n", name,
+               ns / samples,
+               static_cast<double>(cycles) /
+                   static_cast<double>(buffers * samples),
+               sink);
+  };
+  fmt::print("adc filters, {} samples per buffer:\n", samples);
+  // The fold adc2dma::read_averaged_adc did.
+  report("plain sum", [&] {
+    return std::accumulate(plain.begin(), plain.end(), std::int_fast32_t{}) /
+           static_cast<std::int_fast32_t>(samples);
+  });
+  report("sum_packed_samples", [&] {
+    return sum_packed_samples(packed) / samples;
+  });
+  auto mean = adc_pipeline(boxcar<samples>{}, ema<2>{});
+  report("boxcar + ema", [&] { return *mean.run(packed); });
+  auto med = adc_pipeline(median<5>{});
+  report("median<5>", [&] { return *med.run(packed); });
+  auto decimate = adc_pipeline(cic<8, 3>{});
+  report("cic<8, 3>", [&] { return *decimate.run(packed); });
+  auto smooth =
+      adc_pipeline(fir<std::array<std::int32_t, 5>{1, 4, 6, 4, 1}, 4>{});
+  report("fir 5 taps", [&] { return *smooth.run(packed); });
+}
+
+// Time spent in the DMA IRQ of buttons_core per block, with the CPU or the
+// sniffer summing. Only take() is timed, not the simulated transfer.
+template <adc_averaging mode, typename Pipeline>
+void bench_adc_isr(std::string_view name, Pipeline filter) {
+  using namespace std::chrono;
+  constexpr std::size_t blocks = 1u << 14;
+  auto rng = std::minstd_rand{};
+  auto samples = std::vector<std::uint16_t>(4099);
+  for (auto &v : samples) {
+    v = static_cast<std::uint16_t>(rng() % 4096);
+  }
+  auto capture = adc_dma_capture<sim_adc_dma, 512, mode>(sim_adc_dma(samples));
+  capture.start();
+  auto in_isr = steady_clock::duration{};
+  std::int64_t sink{};
+  for (std::size_t i = 0; i < blocks; ++i) {
+    capture.hal().complete();
+    auto const start = steady_clock::now();
+    sink += *capture.take(filter);
+    in_isr += steady_clock::now() - start;
+  }
+  fmt::print("  {:<16}{:8.2f} ns/irq ({})\n", name,
+             duration<double, std::nano>(in_isr).count() / blocks, sink);
+}
+
+// The timer mix of the 3bit calculator: the result flasher, the reset of the
+// wake pulse sent to the other core and the debounce confirmation. Slack as
+// in the app, or none.
+template <bool> struct sim_flash_slack {};
+template <> struct sim_flash_slack<true> {
+  static constexpr auto slack = std::chrono::milliseconds(50);
+};
+template <bool> struct sim_reset_slack {};
+template <> struct sim_reset_slack<true> {
+  static constexpr auto slack = std::chrono::milliseconds(1);
+};
+template <bool with_slack> struct sim_flash : sim_flash_slack<with_slack> {
+  void operator()(auto &q, bench_time_point const &tp) const {
+    q.que(*this, tp + std::chrono::seconds(1));
+  }
+};
+template <bool with_slack>
+struct sim_wake_reset : sim_reset_slack<with_slack> {
+  void operator()(auto &, bench_time_point const &) const {}
+};
+template <bool with_slack> struct sim_debounce {
+  void operator()(auto &q, bench_time_point const &tp) const {
+    q.que(sim_wake_reset<with_slack>{}, tp + std::chrono::microseconds(100));
+  }
+};
+
+struct bench_alarm_hal {
+  using time_point = bench_time_point;
+  bench_time_point const *now;
+  bool arm(time_point const &tp) const { return tp <= *now; }
+  static void cancel() {}
+};
+
+// Event driven run of the main loop: wakes up for the next timer or for a
+// button edge, whichever comes first. Buttons are pressed about twice a
+// second and bounce three times within a millisecond.
+template <bool with_slack> void simulate_3bit_timers(std::size_t minutes) {
+  using namespace std::chrono;
+  auto q = typed_time_queue<bench_time_point, sim_flash<with_slack>,
+                            sim_wake_reset<with_slack>,
+                            sim_debounce<with_slack>>{};
+  auto rng = std::minstd_rand{};
+  auto const end = bench_time_point{} + minutes * 1min;
+  auto now = bench_time_point{};
+  auto next_press = now + milliseconds(rng() % 1000);
+  int bounces{};
+  std::size_t timer_wakeups{};
+  std::size_t edge_wakeups{};
+  // Before the retargeting alarm, every idle with a deadline allocated an
+  // alarm from the pool and cancelled the previous one.
+  std::size_t pool_alarms{};
+  auto alarm = retargeting_alarm(bench_alarm_hal{&now});
+  q.que(sim_flash<with_slack>{}, now);
+  while (now < end) {
+    auto timer = q.next();
+    if (timer && *timer < next_press) {
+      now = *timer;
+      ++timer_wakeups;
+    } else {
+      now = next_press;
+      ++edge_wakeups;
+      q.que(sim_debounce<with_slack>{}, now + milliseconds(5));
+      next_press = ++bounces % 3 != 0
+                       ? now + microseconds(rng() % 500)
+                       : now + milliseconds(rng() % 1000);
+    }
+    q.execute_all(now);
+    if (auto next = q.next()) {
+      ++pool_alarms;
+      alarm.set(*next);
+    }
+  }
+  auto const per_minute = [minutes](auto count) {
+    return static_cast<double>(count) / static_cast<double>(minutes);
+  };
+  fmt::print("  {:<16}{:8.1f} timer wakeups/min, {:.1f} edge wakeups/min, "
+             "{} shared\n",
+             with_slack ? "with slack" : "exact", per_minute(timer_wakeups),
+             per_minute(edge_wakeups), q.shared_wakeups());
+  fmt::print("  {:<16}{:8.0f} alarm retargets/h, {:.0f} unchanged/h, "
+             "{:.0f} pool add+cancel/h before\n",
+             "", 60 * per_minute(alarm.arms()),
+             60 * per_minute(alarm.unchanged()), 60 * per_minute(pool_alarms));
+}
+
+// The DMA IRQ of buttons_core over a minute awake, with the knob turned at
+// 10s and at 40s and left alone otherwise. Each block mean carries some
+// noise. The ADC either runs at the full rate throughout, or as the app
+// does, at a background rate until the filtered value moves.
+template <bool adaptive> void simulate_adc_irq_rate() {
+  using namespace std::chrono;
+  constexpr std::uint32_t block = 512;
+  constexpr std::uint32_t background_rate = 8'000;
+  auto rng = std::minstd_rand{};
+  auto knob = [](bench_time_point::duration t) {
+    auto const ms = duration_cast<milliseconds>(t).count();
+    if (ms < 10'000) {
+      return 2000;
+    } else if (ms < 12'000) {
+      return 2000 + static_cast<int>(ms - 10'000) / 2;
+    } else if (ms < 40'000) {
+      return 3000;
+    } else if (ms < 41'000) {
+      return 3000 - static_cast<int>(ms - 40'000) * 3 / 2;
+    }
+    return 1500;
+  };
+  auto filter = adc_pipeline(ema<2>{});
+  auto change = adc_change_detector<bench_time_point>(16, 16, 20ms, 50ms);
+  auto rate = adc_rate_controller<bench_time_point>(500ms);
+  auto irqs = per_second_counter<bench_time_point>{};
+  auto const start = bench_time_point{};
+  auto now = start;
+  std::uint32_t total{};
+  std::uint32_t still_rate{};
+  while (now - start < 1min) {
+    auto const sps = adaptive && rate.rate() == adc_rate::background
+                         ? background_rate
+                         : adc_max_rate;
+    now += ceil<bench_time_point::duration>(duration<double>(
+        static_cast<double>(block) / static_cast<double>(sps)));
+    ++total;
+    irqs.note(now);
+    if (now - start >= 30s && still_rate == 0) {
+      still_rate = irqs.per_second();
+    }
+    auto const noise = static_cast<int>(rng() % 17) - 8;
+    auto const filtered = filter.run(knob(now - start) + noise);
+    rate.push(change.push(*filtered, now), now);
+  }
+  fmt::print("  {:<16}{:8.1f} irq/s mean, {} irq/s still, {} irq/s peak, "
+             "{} activities\n",
+             adaptive ? "adaptive" : "full rate", total / 60.0, still_rate,
+             irqs.peak(), change.activities());
+}
+} // namespace
+} // namespace myb
+
+int main() {
+  using namespace myb;
+  bench_gpio_dispatch<4>();
+  bench_gpio_dispatch<16>();
+  bench_gpio_dispatch<30>();
+  bench_led_binary_out<20, 21, 22, 26, 27, 28>();
+  bench_time_queue<8>();
+  bench_time_queue<32>();
+  bench_time_queue<64>();
+  bench_timing_wheel<100>();
+  bench_timing_wheel<10000>();
+  bench_co_task();
+  bench_adc_filters();
+  fmt::print("adc dma irq, 512 samples per block:\n");
+  bench_adc_isr<adc_averaging::cpu>("cpu sum",
+                                    adc_pipeline(boxcar<512>{}, ema<2>{}));
+  bench_adc_isr<adc_averaging::sniffer>("sniffer", adc_pipeline(ema<2>{}));
+  fmt::print("adc dma irq rate over a minute awake:\n");
+  simulate_adc_irq_rate<false>();
+  simulate_adc_irq_rate<true>();
+  fmt::print("3bit calculator timer mix:\n");
+  simulate_3bit_timers<false>(60);
+  simulate_3bit_timers<true>(60);
+}
@@ -1,8 +1,15 @@
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bitset>
 #include <chrono>
+#include <cmath>
+#include <numbers>
+#include <numeric>
+#include <random>
 #include <thread>
+#include <vector>
 
 #ifdef MYB_PICO
 #include <class/cdc/cdc_device.h>
@@ -14,7 +21,11 @@
 
 #include <fmt/core.h>
 
+#include <myb/adc.hpp>
+#include <myb/led.hpp>
 #include <myb/myb.hpp>
+#include <myb/sim.hpp>
+#include <myb/task.hpp>
 
 #include <cta/cta.hpp>
 
@@ -122,6 +133,94 @@ CTA_TEST(ui_ctx_callback, ctx) {
   ctx.expect_that(ui.trigger_gpio(3, cb_fun), eq(false));
   ctx.expect_that(callbacked, eq(2));
 }
+CTA_TEST(ui_ctx_dispatch_modes, ctx) {
+  dummy_toggle t1;
+  dummy_toggle t2;
+  dummy_toggle t3;
+  auto ui = ui_context::builder()
+                .gpios(gpio_sel<29> >> std::ref(t1), gpio_sel<4> >> std::ref(t2),
+                       gpio_sel<29> >> std::ref(t3))
+                .build();
+  ctx.expect_that(ui.trigger_gpio(29), eq(true));
+  ctx.expect_that(ui.trigger_gpio<gpio_dispatch::fold>(29), eq(true));
+  ctx.expect_that(t1.toggle_count, eq(2));
+  ctx.expect_that(t3.toggle_count, eq(0));
+  ctx.expect_that(ui.trigger_gpio(4u), eq(true));
+  ctx.expect_that(ui.trigger_gpio<gpio_dispatch::fold>(4u), eq(true));
+  ctx.expect_that(t2.toggle_count, eq(2));
+  ctx.expect_that(ui.trigger_gpio(5), eq(false));
+  ctx.expect_that(ui.trigger_gpio(30), eq(false));
+  ctx.expect_that(ui.trigger_gpio(-1), eq(false));
+  ctx.expect_that(ui.trigger_gpio<gpio_dispatch::fold>(5), eq(false));
+}
+CTA_TEST(ui_ctx_mask_dispatch, ctx) {
+  int callbacked{};
+  dummy_toggle t1;
+  dummy_toggle t2;
+  dummy_toggle t3;
+  auto ui = ui_context::builder()
+                .gpios(gpio_sel<1> >> std::ref(t1), gpio_sel<7> >> std::ref(t2),
+                       gpio_sel<31> >> std::ref(t3))
+                .build();
+  auto cb_fun = [&callbacked] { ++callbacked; };
+  ctx.expect_that(decltype(ui)::input_mask, eq(0x80000082u));
+  ctx.expect_that(ui.trigger_gpio_mask(0b10000010u, cb_fun), eq(2));
+  ctx.expect_that(callbacked, eq(1));
+  ctx.expect_that(t1.toggle_count, eq(1));
+  ctx.expect_that(t2.toggle_count, eq(1));
+  ctx.expect_that(t3.toggle_count, eq(0));
+  ctx.expect_that(ui.trigger_gpio_mask(0xffffffffu, cb_fun), eq(3));
+  ctx.expect_that(callbacked, eq(2));
+  ctx.expect_that(t1.toggle_count, eq(2));
+  ctx.expect_that(t2.toggle_count, eq(2));
+  ctx.expect_that(t3.toggle_count, eq(1));
+  ctx.expect_that(ui.trigger_gpio_mask(0b101u, cb_fun), eq(0));
+  ctx.expect_that(ui.trigger_gpio_mask(0u, cb_fun), eq(0));
+  ctx.expect_that(callbacked, eq(2));
+  ctx.expect_that(t1.toggle_count, eq(2));
+}
+struct fake_latency_clock {
+  static inline std::uint32_t now{};
+  std::uint32_t operator()() const { return now; }
+};
+struct advance_fake_clock {
+  std::uint32_t ticks{};
+  void trigger() noexcept { fake_latency_clock::now += ticks; }
+  static constexpr void on_sleep() noexcept {}
+  static constexpr void on_wake() noexcept {}
+};
+CTA_TEST(ui_ctx_latency_histograms, ctx) {
+  using trace_t = latency_histograms<fake_latency_clock, 8, 6>;
+  auto ui = ui_context::builder()
+                .trace<trace_t>()
+                .gpios(gpio_sel<1> >> advance_fake_clock{3},
+                       gpio_sel<2> >> advance_fake_clock{0},
+                       gpio_sel<3> >> advance_fake_clock{1000})
+                .build();
+  ui.trigger_gpio(1);
+  ui.trigger_gpio(1);
+  ui.trigger_gpio(2);
+  ui.trigger_gpio(3);
+  ui.trigger_gpio(4);
+  auto const &lat = ui.latency();
+  ctx.expect_that(lat.count(1, 2), eq(2u));
+  ctx.expect_that(lat.max_latency(1), eq(3u));
+  ctx.expect_that(lat.count(2, 0), eq(1u));
+  ctx.expect_that(lat.count(3, 5), eq(1u));
+  ctx.expect_that(lat.max_latency(3), eq(1000u));
+  // Later pins in a batch include the earlier pins' trigger time.
+  ui.trigger_gpio_mask(0b1110u);
+  ctx.expect_that(lat.count(1, 2), eq(3u));
+  ctx.expect_that(lat.count(2, 2), eq(1u));
+  ctx.expect_that(lat.max_latency(3), eq(1003u));
+  // Timed from when each pin's interrupt was taken instead.
+  auto const irq_at = fake_latency_clock::now - 40;
+  ui.trigger_gpio_mask(0b1010u, [irq_at](std::size_t) { return irq_at; });
+  ctx.expect_that(lat.max_latency(1), eq(43u));
+  ctx.expect_that(lat.count(3, 5), eq(3u));
+  ctx.expect_that(lat.max_latency(3), eq(1043u));
+  ctx.expect_that(std::is_empty_v<no_latency_trace>, eq(true));
+}
 CTA_TEST(sleep_and_wake, ctx) {
   dummy_toggle t1;
   dummy_toggle t2;
@@ -156,6 +255,68 @@ CTA_TEST(all_inputs_in_ctx, ctx) {
   ctx.expect_that(pins_cb.calls_2, eq(1));
   ctx.expect_that(pins_cb.calls_err, eq(0));
 }
+CTA_TEST(spsc_ring_overflow, ctx) {
+  auto ring = spsc_ring<int, 4>{};
+  ctx.expect_that(ring.empty(), eq(true));
+  for (int i = 0; i < 6; ++i) {
+    ring.push(i);
+  }
+  ctx.expect_that(ring.overflows(), eq(2u));
+  ctx.expect_that(ring.pop(), eq(std::optional<int>(0)));
+  ctx.expect_that(ring.high_water(), eq(4u));
+  ctx.expect_that(ring.push(6), eq(true));
+  auto drained = std::vector<int>{};
+  ctx.expect_that(ring.drain([&drained](int v) { drained.push_back(v); }),
+                  eq(4u));
+  ctx.expect_that(drained, eq(std::vector{1, 2, 3, 6}));
+  ctx.expect_that(ring.empty(), eq(true));
+  ctx.expect_that(ring.pop(), eq(std::nullopt));
+}
+CTA_TEST(gpio_event_batches, ctx) {
+  auto ring = spsc_ring<gpio_event, 8>{};
+  push_gpio_edges(ring, 0b1010u, 0b1000u, 10u);
+  push_gpio_edges(ring, 0b0110u, 0b1000u, 11u);
+  auto batches = std::vector<std::uint32_t>{};
+  drain_gpio_batches(ring, [&batches](std::uint32_t b) {
+    batches.push_back(b);
+  });
+  ctx.expect_that(batches, eq(std::vector<std::uint32_t>{0b1010u, 0b0110u}));
+  ctx.expect_that(ring.empty(), eq(true));
+}
+#ifndef MYB_PICO
+CTA_TEST(spsc_ring_two_threads, ctx) {
+  constexpr std::uint32_t total = 1'000'000;
+  auto ring = spsc_ring<std::uint32_t, 64>{};
+  std::uint32_t failed_pushes{};
+  auto producer = std::thread([&] {
+    for (std::uint32_t i = 0; i < total;) {
+      if (ring.push(i)) {
+        ++i;
+      } else {
+        ++failed_pushes;
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::uint32_t expected{};
+  std::uint32_t out_of_order{};
+  while (expected < total) {
+    if (ring.drain([&](std::uint32_t v) {
+          if (v != expected) {
+            ++out_of_order;
+          }
+          expected = v + 1;
+        }) == 0) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  ctx.expect_that(out_of_order, eq(0u));
+  ctx.expect_that(expected, eq(total));
+  ctx.expect_that(ring.overflows(), eq(failed_pushes));
+  ctx.expect_that(ring.high_water() <= 64u, eq(true));
+}
+#endif
 CTA_TEST(led_raii_init_light_destruct, ctx) {
   dummy_output_pin pin;
   {
@@ -448,6 +609,1376 @@ CTA_TEST(typed_time_queue_unque, ctx) {
   ctx.expect_that(val_a, eq(0));
   ctx.expect_that(val_b, eq(1));
 }
+CTA_TEST(debounce_bounce_traces, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  static auto debouncer = gpio_debouncer<time_point, 8>(5ms);
+  static auto triggers = std::array<int, 8>{};
+  static auto stamps = std::array<std::uint32_t, 8>{};
+  static std::uint32_t levels{};
+  debouncer.settle_time(5, 2ms);
+  triggers = {};
+  stamps = {};
+  levels = {};
+  struct count_triggers {
+    void operator()(std::uint32_t pins) const {
+      for (; pins != 0; pins &= pins - 1) {
+        auto const pin = std::countr_zero(pins);
+        ++triggers[pin];
+        stamps[pin] = debouncer.edge_stamp(pin);
+      }
+    }
+  };
+  using confirm_t =
+      debounce_confirm<decltype([]() -> auto & { return debouncer; }),
+                       count_triggers, decltype([] { return levels; })>;
+  auto q = typed_time_queue(time_point{}, confirm_t{});
+  struct recorded_level {
+    std::uint8_t pin;
+    microseconds at;
+    bool high;
+  };
+  // Two presses on pin 3 and one on pin 5, each with contact bounce. Only
+  // rising edges reach the debouncer, and the releases bounce with rising
+  // edges too.
+  auto const trace = std::array{
+      recorded_level{3, 0us, true},       recorded_level{3, 100us, false},
+      recorded_level{3, 300us, true},     recorded_level{3, 500us, false},
+      recorded_level{3, 900us, true},     recorded_level{3, 1000us, false},
+      recorded_level{3, 1500us, true},    recorded_level{3, 4000us, false},
+      recorded_level{3, 4200us, true},    recorded_level{5, 20000us, true},
+      recorded_level{5, 20050us, false},  recorded_level{5, 20100us, true},
+      recorded_level{5, 21000us, false},  recorded_level{5, 21900us, true},
+      recorded_level{3, 30000us, false},  recorded_level{3, 30200us, true},
+      recorded_level{3, 30300us, false},  recorded_level{3, 31000us, true},
+      recorded_level{3, 31100us, false},  recorded_level{5, 40000us, false},
+      recorded_level{5, 40400us, true},   recorded_level{5, 40500us, false},
+      recorded_level{3, 60000us, true},   recorded_level{3, 60020us, false},
+      recorded_level{3, 60050us, true},   recorded_level{3, 64000us, false},
+      recorded_level{3, 64900us, true},   recorded_level{3, 80000us, false},
+      recorded_level{3, 80100us, true},   recorded_level{3, 80150us, false},
+  };
+  auto next_level = trace.begin();
+  auto fired_at = std::array<microseconds, 3>{};
+  auto fired_count = 0;
+  for (auto now = 0us; now < 100ms; now += 50us) {
+    auto tp = time_point(now);
+    for (; next_level != trace.end() && next_level->at <= now; ++next_level) {
+      auto const bit = std::uint32_t{1} << next_level->pin;
+      if (next_level->high) {
+        levels |= bit;
+        q.que(confirm_t{},
+              debouncer.edge(next_level->pin, tp,
+                             static_cast<std::uint32_t>(now.count())));
+      } else {
+        levels &= ~bit;
+      }
+    }
+    auto before = triggers[3] + triggers[5];
+    q.execute_all(tp);
+    if (triggers[3] + triggers[5] != before && fired_count < 3) {
+      fired_at[fired_count++] = now;
+    }
+  }
+  ctx.expect_that(triggers[3], eq(2));
+  ctx.expect_that(triggers[5], eq(1));
+  ctx.expect_that(fired_count, eq(3));
+  ctx.expect_that(fired_at[0], eq(microseconds(9200us)));
+  ctx.expect_that(fired_at[1], eq(microseconds(23900us)));
+  ctx.expect_that(fired_at[2], eq(microseconds(69900us)));
+  // Dispatch sees the stamp of the first edge of each press.
+  ctx.expect_that(stamps[3], eq(60000u));
+  ctx.expect_that(stamps[5], eq(20000u));
+  ctx.expect_that(debouncer.pending(), eq(0u));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+}
+template <typename UI>
+concept press_dispatchable = requires(UI &ui) {
+  ui.trigger_gpio(1);
+  ui.trigger_gpio_mask(1u);
+};
+CTA_TEST(gesture_long_press_and_double_click, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  int long_presses{};
+  int double_clicks{};
+  int plain{};
+  dummy_toggle t1;
+  auto ui =
+      ui_context::builder()
+          .gpios(gpio_sel<16> >> on_long_press([&] { ++long_presses; }),
+                 gpio_sel<16> >> on_double_click([&] { ++double_clicks; }),
+                 gpio_sel<3> >> std::ref(t1),
+                 gpio_sel<4> >> no_sleep_wake([&] { ++plain; }))
+          .build();
+  auto at = [](auto d) { return time_point(d); };
+  // short click: nothing yet, long press deadline armed
+  ui.gpio_edge(16, true, at(0ms));
+  ctx.expect_that(ui.next_gesture_deadline(at(0ms)), eq(at(500ms)));
+  ui.gpio_edge(16, false, at(100ms));
+  ctx.expect_that(ui.next_gesture_deadline(at(100ms)), eq(at(400ms)));
+  ctx.expect_that(ui.gesture_tick(at(400ms)), eq(0));
+  ctx.expect_that(ui.next_gesture_deadline(at(400ms)), eq(std::nullopt));
+  // double click
+  ui.gpio_edge(16, true, at(1000ms));
+  ui.gpio_edge(16, false, at(1080ms));
+  ctx.expect_that(ui.gpio_edge(16, true, at(1200ms)), eq(1));
+  ui.gpio_edge(16, false, at(1250ms));
+  ctx.expect_that(double_clicks, eq(1));
+  ctx.expect_that(long_presses, eq(0));
+  // too slow for a double click
+  ui.gpio_edge(16, true, at(2000ms));
+  ui.gpio_edge(16, false, at(2050ms));
+  ui.gesture_tick(at(2400ms));
+  ui.gpio_edge(16, true, at(2450ms));
+  ui.gpio_edge(16, false, at(2500ms));
+  ctx.expect_that(double_clicks, eq(1));
+  // long press fires once at the deadline, not on release
+  ui.gpio_edge(16, true, at(5000ms));
+  ctx.expect_that(ui.gesture_tick(at(5499ms)), eq(0));
+  ctx.expect_that(ui.gesture_tick(at(5500ms)), eq(1));
+  ctx.expect_that(ui.gesture_tick(at(6000ms)), eq(0));
+  ui.gpio_edge(16, false, at(6000ms));
+  ctx.expect_that(long_presses, eq(1));
+  ctx.expect_that(double_clicks, eq(1));
+  // plain actions trigger on press only
+  ctx.expect_that(ui.gpio_edge(3, true, at(7000ms)), eq(1));
+  ctx.expect_that(ui.gpio_edge(3, false, at(7001ms)), eq(0));
+  ctx.expect_that(t1.toggle_count, eq(1));
+  ctx.expect_that(ui.gpio_edge(4, true, at(7002ms)), eq(1));
+  ctx.expect_that(plain, eq(1));
+  // Press-only dispatch would fire the long press straight away.
+  static_assert(!press_dispatchable<decltype(ui)>);
+}
+CTA_TEST(gesture_chord, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  int chords{};
+  auto ui = ui_context::builder()
+                .gpios(gpio_sel<10> >> on_chord<11, 12>([&] { ++chords; }))
+                .build();
+  auto at = [](auto d) { return time_point(d); };
+  ui.gpio_edge(11, true, at(0ms));
+  ui.gpio_edge(12, true, at(5ms));
+  ctx.expect_that(ui.gpio_edge(10, true, at(10ms)), eq(1));
+  ctx.expect_that(ui.held(), eq(0b1110000000000u));
+  ui.gpio_edge(10, false, at(50ms));
+  ui.gpio_edge(11, false, at(50ms));
+  ui.gpio_edge(12, false, at(50ms));
+  ctx.expect_that(chords, eq(1));
+  // bound pin first, the rest within the window
+  ui.gpio_edge(10, true, at(100ms));
+  ui.gpio_edge(12, true, at(120ms));
+  ctx.expect_that(ui.gpio_edge(11, true, at(150ms)), eq(1));
+  ctx.expect_that(chords, eq(2));
+  ui.gpio_edge(10, false, at(200ms));
+  ui.gpio_edge(11, false, at(200ms));
+  ui.gpio_edge(12, false, at(200ms));
+  // outside the window
+  ui.gpio_edge(10, true, at(300ms));
+  ui.gesture_tick(at(380ms));
+  ui.gpio_edge(11, true, at(390ms));
+  ui.gpio_edge(12, true, at(395ms));
+  ctx.expect_that(chords, eq(2));
+}
+CTA_TEST(gesture_timeout_queue, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  static int long_presses{};
+  long_presses = 0;
+  static auto ui = ui_context::builder()
+                       .gpios(gpio_sel<2> >> on_long_press(
+                                  [] { ++long_presses; }, gesture_ms<200>))
+                       .build();
+  using timeout_t = gesture_timeout<decltype([]() -> auto & { return ui; })>;
+  auto q = typed_time_queue(time_point{}, timeout_t{});
+  auto tp = time_point(1s);
+  ui.gpio_edge(2, true, tp);
+  q.que(timeout_t{}, *ui.next_gesture_deadline(tp));
+  ctx.expect_that(q.execute_all(tp + 199ms), eq(0));
+  ctx.expect_that(q.execute_all(tp + 200ms), eq(1));
+  ctx.expect_that(long_presses, eq(1));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+}
+template <int> struct order_recorder {
+  std::vector<int> *order;
+  void operator()(auto &&...) const { order->push_back(id); }
+  int id;
+};
+CTA_TEST(typed_time_queue_deadline_order, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto order = std::vector<int>{};
+  auto to_test = typed_time_queue(
+      time_point{}, order_recorder<0>{&order, 0}, order_recorder<1>{&order, 1},
+      order_recorder<2>{&order, 2}, order_recorder<3>{&order, 3},
+      order_recorder<4>{&order, 4});
+  auto rng = std::minstd_rand{};
+  for (int round = 0; round < 200; ++round) {
+    auto deadlines = std::array<std::optional<int>, 5>{};
+    auto que_at = [&]<int i>(order_recorder<i> const &r) {
+      if (rng() % 4 == 0) {
+        to_test.unque(r);
+        deadlines[i] = std::nullopt;
+      } else {
+        deadlines[i] = static_cast<int>(rng() % 16);
+        to_test.que(r, time_point(nanoseconds(*deadlines[i])));
+      }
+    };
+    que_at(order_recorder<0>{});
+    que_at(order_recorder<1>{});
+    que_at(order_recorder<2>{});
+    que_at(order_recorder<3>{});
+    que_at(order_recorder<4>{});
+    auto expected = std::vector<std::pair<int, int>>{};
+    for (int i = 0; i < 5; ++i) {
+      if (deadlines[i]) {
+        expected.emplace_back(*deadlines[i], i);
+      }
+    }
+    std::ranges::stable_sort(expected, {}, &std::pair<int, int>::first);
+    if (expected.empty()) {
+      ctx.expect_that(to_test.next(), eq(std::nullopt));
+    } else {
+      ctx.expect_that(to_test.next(),
+                      eq(time_point(nanoseconds(expected.front().first))));
+    }
+    order.clear();
+    ctx.expect_that(to_test.execute_all(time_point(16ns)),
+                    eq(static_cast<int>(expected.size())));
+    auto expected_order = std::vector<int>{};
+    for (auto const &e : expected) {
+      expected_order.push_back(e.second);
+    }
+    ctx.expect_that(order, eq(expected_order));
+  }
+}
+template <int i> struct periodic_recorder {
+  std::vector<std::pair<int, long long>> *runs;
+  void operator()(auto &q, auto const &tp) const {
+    using namespace std::chrono;
+    runs->emplace_back(i,
+                       duration_cast<seconds>(tp.time_since_epoch()).count());
+    q.que(*this, tp + seconds(i + 1));
+  }
+};
+CTA_TEST(typed_time_queue_catch_up_after_sleep, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  using run_list = std::vector<std::pair<int, long long>>;
+  auto runs = run_list{};
+  auto to_test = typed_time_queue(time_point{}, periodic_recorder<0>{&runs},
+                                  periodic_recorder<1>{&runs});
+  to_test.que(periodic_recorder<0>{}, time_point(1s));
+  to_test.que(periodic_recorder<1>{}, time_point(0s));
+  auto const woke_up = time_point(4500ms);
+  // Every entry runs at most once per call, oldest deadline first.
+  ctx.expect_that(to_test.execute_all(woke_up), eq(2));
+  ctx.expect_that(runs, eq(run_list{{1, 0}, {0, 1}}));
+  ctx.expect_that(to_test.next(), eq(time_point(2s)));
+  runs.clear();
+  int calls{};
+  while (to_test.next() <= woke_up) {
+    ++calls;
+    to_test.execute_all(woke_up);
+  }
+  ctx.expect_that(calls, eq(3));
+  ctx.expect_that(runs, eq(run_list{{0, 2}, {1, 2}, {0, 3}, {1, 4}, {0, 4}}));
+  ctx.expect_that(to_test.next(), eq(time_point(5s)));
+}
+template <int i> struct cancelling_entry {
+  std::vector<int> *order;
+  void operator()(auto &q, auto const &) const {
+    using namespace std::chrono;
+    order->push_back(i);
+    if constexpr (i == 0) {
+      q.unque(cancelling_entry<1>{});
+      q.que(cancelling_entry<2>{}, steady_clock::time_point(50s));
+    }
+  }
+};
+CTA_TEST(typed_time_queue_batch_honours_changes, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto order = std::vector<int>{};
+  auto to_test = typed_time_queue(
+      time_point{}, cancelling_entry<0>{&order}, cancelling_entry<1>{&order},
+      cancelling_entry<2>{&order}, cancelling_entry<3>{&order});
+  to_test.que(cancelling_entry<0>{}, time_point(1s));
+  to_test.que(cancelling_entry<1>{}, time_point(2s));
+  to_test.que(cancelling_entry<2>{}, time_point(3s));
+  to_test.que(cancelling_entry<3>{}, time_point(4s));
+  ctx.expect_that(to_test.execute_all(time_point(10s)), eq(2));
+  ctx.expect_that(order, eq(std::vector{0, 3}));
+  ctx.expect_that(to_test.next(), eq(time_point(50s)));
+}
+template <int i> struct slack_recorder : order_recorder<i> {
+  static constexpr auto slack = std::chrono::milliseconds(10 * i);
+};
+CTA_TEST(typed_time_queue_slack_coalescing, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto order = std::vector<int>{};
+  auto to_test = typed_time_queue(time_point{}, order_recorder<0>{&order, 0},
+                                  slack_recorder<1>{{&order, 1}},
+                                  slack_recorder<3>{{&order, 3}});
+  to_test.que(slack_recorder<1>{}, time_point(100ms));
+  to_test.que(slack_recorder<3>{}, time_point(95ms));
+  ctx.expect_that(to_test.next(), eq(time_point(110ms)));
+  to_test.que(order_recorder<0>{}, time_point(105ms));
+  ctx.expect_that(to_test.next(), eq(time_point(105ms)));
+  // Everything rides along on the wakeup of the entry without slack.
+  ctx.expect_that(to_test.execute_all(time_point(105ms)), eq(3));
+  ctx.expect_that(order, eq(std::vector{3, 1, 0}));
+  ctx.expect_that(to_test.shared_wakeups(), eq(2u));
+  ctx.expect_that(to_test.next(), eq(std::nullopt));
+  to_test.que(slack_recorder<3>{}, time_point(200ms));
+  to_test.unque(slack_recorder<3>{});
+  ctx.expect_that(to_test.next(), eq(std::nullopt));
+}
+CTA_TEST(isr_time_queue_applies_posts, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto order = std::vector<int>{};
+  auto to_test = isr_time_queue(time_point{}, order_recorder<0>{&order, 0},
+                                order_recorder<1>{&order, 1});
+  to_test.que(order_recorder<0>{}, time_point(20ms));
+  to_test.que_from_isr(order_recorder<1>{}, time_point(10ms));
+  ctx.expect_that(to_test.next(), eq(time_point(10ms)));
+  // A post overrides what was queued before it was applied.
+  to_test.que(order_recorder<1>{}, time_point(5ms));
+  to_test.unque_from_isr(order_recorder<1>{});
+  to_test.que_from_isr(order_recorder<0>{}, time_point(30ms));
+  ctx.expect_that(to_test.execute_all(time_point(25ms)), eq(0));
+  ctx.expect_that(to_test.next(), eq(time_point(30ms)));
+  // Applied posts are not applied again.
+  to_test.que(order_recorder<0>{}, time_point(15ms));
+  ctx.expect_that(to_test.execute_all(time_point(25ms)), eq(1));
+  ctx.expect_that(order, eq(std::vector{0}));
+  ctx.expect_that(to_test.next(), eq(std::nullopt));
+}
+#ifndef MYB_PICO
+CTA_TEST(isr_time_queue_two_threads, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  constexpr std::int64_t total = 200'000;
+  // Both halves of the posted value change on every post, so a torn read
+  // shows up as a value that is not a multiple of the step.
+  constexpr std::int64_t step = (std::int64_t{1} << 32) + 1;
+  auto order = std::vector<int>{};
+  auto to_test = isr_time_queue(time_point{}, order_recorder<0>{&order, 0},
+                                order_recorder<1>{&order, 1});
+  auto done = std::atomic<bool>{};
+  auto isr = std::thread([&] {
+    for (std::int64_t i = 1; i <= total; ++i) {
+      to_test.que_from_isr(order_recorder<1>{},
+                           time_point(nanoseconds(i * step)));
+    }
+    done.store(true);
+  });
+  std::int64_t last{};
+  int torn{};
+  int backwards{};
+  int runs{};
+  auto check = [&] {
+    if (auto n = to_test.next()) {
+      auto v = n->time_since_epoch().count();
+      torn += v % step != 0;
+      backwards += v < last;
+      last = v;
+    }
+  };
+  while (!done.load()) {
+    to_test.que(order_recorder<0>{}, time_point{});
+    runs += to_test.execute_all(time_point{});
+    to_test.unque(order_recorder<0>{});
+    check();
+  }
+  isr.join();
+  check();
+  ctx.expect_that(torn, eq(0));
+  ctx.expect_that(backwards, eq(0));
+  ctx.expect_that(last, eq(total * step));
+  ctx.expect_that(static_cast<int>(order.size()), eq(runs));
+}
+#endif
+CTA_TEST(timing_wheel_matches_reference, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  constexpr std::size_t timers = 48;
+  auto rng = std::minstd_rand{};
+  auto reference = std::array<std::optional<time_point>, timers>{};
+  auto requeue = std::array<bool, timers>{};
+  auto ran = std::array<bool, timers>{};
+  int fired{};
+  auto on_expire = [&](auto &wheel, std::size_t id, time_point tp) {
+    ++fired;
+    ran[id] = true;
+    ctx.expect_that(reference[id], eq(tp));
+    reference[id] = std::nullopt;
+    if (std::exchange(requeue[id], false)) {
+      reference[id] = tp + nanoseconds(rng() % 5000);
+      wheel.que(id, *reference[id]);
+    }
+  };
+  auto to_test = timing_wheel<time_point, nanoseconds, timers,
+                              decltype(on_expire)>(time_point{}, on_expire);
+  auto now = time_point{};
+  for (int round = 0; round < 400; ++round) {
+    for (int changes = 0; changes < 8; ++changes) {
+      auto id = rng() % timers;
+      if (rng() % 5 == 0) {
+        to_test.unque(id);
+        reference[id] = std::nullopt;
+      } else {
+        // Spread over all levels and the overflow list.
+        auto delay = nanoseconds(rng() % (std::uint64_t{1} << (rng() % 27)));
+        reference[id] = now + delay;
+        to_test.que(id, *reference[id]);
+        requeue[id] = rng() % 3 == 0;
+      }
+    }
+    auto expected_next = std::ranges::min(
+        reference, [](auto const &l, auto const &r) {
+          return l && (!r || *l < *r);
+        });
+    ctx.expect_that(to_test.next(), eq(expected_next));
+    now += nanoseconds(rng() % (std::uint64_t{1} << (rng() % 25)));
+    fired = 0;
+    ran = {};
+    auto const executed = to_test.execute_all(now);
+    ctx.expect_that(executed, eq(fired));
+    for (std::size_t id = 0; id < timers; ++id) {
+      ctx.expect_that(to_test.is_queued(id), eq(reference[id].has_value()));
+      // Timers requeued when they ran wait for the next call.
+      ctx.expect_that(!reference[id] || *reference[id] > now || ran[id],
+                      eq(true));
+    }
+  }
+}
+CTA_TEST(timing_wheel_runs_each_timer_once_per_call, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  int runs{};
+  // Requeues itself with no delay.
+  auto again = [&runs](auto &wheel, std::size_t id, time_point tp) {
+    ++runs;
+    wheel.que(id, tp);
+  };
+  auto to_test = timing_wheel<time_point, milliseconds, 2, decltype(again)>(
+      time_point{}, again);
+  to_test.que(0, time_point(5ms));
+  ctx.expect_that(to_test.execute_all(time_point(5ms)), eq(1));
+  ctx.expect_that(to_test.next(), eq(time_point(5ms)));
+  ctx.expect_that(to_test.execute_all(time_point(6ms)), eq(1));
+  ctx.expect_that(runs, eq(2));
+  ctx.expect_that(to_test.is_queued(0), eq(true));
+}
+CTA_TEST(timing_wheel_catch_up_after_sleep, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto runs = std::vector<std::pair<std::size_t, long long>>{};
+  auto periodic = [&runs](auto &wheel, std::size_t id, time_point tp) {
+    runs.emplace_back(id,
+                      duration_cast<seconds>(tp.time_since_epoch()).count());
+    wheel.que(id, tp + 1s);
+  };
+  auto to_test =
+      timing_wheel<time_point, milliseconds, 2, decltype(periodic)>(
+          time_point{}, periodic);
+  to_test.que(0, time_point(1s));
+  to_test.que(1, time_point(0s));
+  auto const woke_up = time_point(4500ms);
+  ctx.expect_that(to_test.execute_all(woke_up), eq(2));
+  ctx.expect_that(to_test.next(), eq(time_point(1s)));
+  int calls = 1;
+  while (to_test.next() <= woke_up) {
+    ++calls;
+    to_test.execute_all(woke_up);
+  }
+  ctx.expect_that(calls, eq(5));
+  ctx.expect_that(runs.size(), eq(std::size_t{9}));
+  ctx.expect_that(to_test.next(), eq(time_point(5s)));
+}
+struct mock_power_hal {
+  using time_point = std::chrono::steady_clock::time_point;
+  time_point now_{};
+  std::chrono::microseconds stay{};
+  std::vector<power_state> entered{};
+  time_point now() const { return now_; }
+  void enter(power_state s) {
+    entered.push_back(s);
+    now_ += stay;
+  }
+};
+CTA_TEST(power_scheduler_picks_deepest_state, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto to_test = power_scheduler(
+      mock_power_hal{},
+      power_state_costs<steady_clock::duration>{{
+          {},
+          {5us},
+          {100us},
+      }});
+  auto const now = time_point(1s);
+  ctx.expect_that(to_test.choose(now, now + 3us), eq(power_state::spin));
+  ctx.expect_that(to_test.choose(now, now + 50us), eq(power_state::wfi));
+  ctx.expect_that(to_test.choose(now, now + 10s), eq(power_state::deep_sleep));
+  ctx.expect_that(to_test.choose(now, std::nullopt),
+                  eq(power_state::deep_sleep));
+
+  auto &hal = to_test.hal();
+  hal.now_ = now;
+  hal.stay = 40us;
+  ctx.expect_that(to_test.idle(now + 50us), eq(power_state::wfi));
+  hal.stay = 7ms;
+  ctx.expect_that(to_test.idle(hal.now_ + 10ms), eq(power_state::deep_sleep));
+  ctx.expect_that(to_test.idle(hal.now_ + 10ms), eq(power_state::deep_sleep));
+  ctx.expect_that(to_test.idle(hal.now_ + 3us), eq(power_state::spin));
+  ctx.expect_that(hal.entered,
+                  eq(std::vector{power_state::wfi, power_state::deep_sleep,
+                                 power_state::deep_sleep, power_state::spin}));
+  ctx.expect_that(to_test.entries(power_state::spin), eq(1u));
+  ctx.expect_that(to_test.entries(power_state::deep_sleep), eq(2u));
+  ctx.expect_that(to_test.residency(power_state::wfi),
+                  eq(steady_clock::duration(40us)));
+  ctx.expect_that(to_test.residency(power_state::deep_sleep),
+                  eq(steady_clock::duration(14ms)));
+  to_test.reset_counters();
+  ctx.expect_that(to_test.entries(power_state::deep_sleep), eq(0u));
+}
+CTA_TEST(power_scheduler_disabled_states, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  using duration = steady_clock::duration;
+  auto to_test = power_scheduler(mock_power_hal{},
+                                 power_state_costs<duration>{{
+                                     {},
+                                     {1us},
+                                     {duration::max()},
+                                 }});
+  ctx.expect_that(to_test.choose(time_point{}, time_point(1h)),
+                  eq(power_state::wfi));
+  ctx.expect_that(to_test.choose(time_point{}, std::nullopt),
+                  eq(power_state::wfi));
+}
+CTA_TEST(retargeting_alarm_moves_in_place, ctx) {
+  using namespace std::chrono;
+  using time_point = sim_clock::time_point;
+  sim_clock::set(time_point(1s));
+  auto to_test = retargeting_alarm<counting_alarm_hal>{};
+  ctx.expect_that(to_test.set(time_point(2s)), eq(true));
+  ctx.expect_that(to_test.set(time_point(2s)), eq(true));
+  ctx.expect_that(to_test.set(time_point(3s)), eq(true));
+  ctx.expect_that(to_test.target(), eq(time_point(3s)));
+  ctx.expect_that(to_test.arms(), eq(2u));
+  ctx.expect_that(to_test.unchanged(), eq(1u));
+  ctx.expect_that(to_test.hal().arms, eq(2u));
+  // A target in the past will not fire.
+  ctx.expect_that(to_test.set(time_point(500ms)), eq(false));
+  ctx.expect_that(to_test.target(), eq(std::nullopt));
+  to_test.cancel();
+  ctx.expect_that(to_test.hal().cancels, eq(0u));
+  to_test.set(time_point(4s));
+  to_test.cancel();
+  ctx.expect_that(to_test.cancels(), eq(1u));
+  ctx.expect_that(to_test.hal().cancels, eq(1u));
+  ctx.expect_that(to_test.hal().arms, eq(4u));
+}
+struct sim_press_counter {
+  int *count;
+  constexpr void trigger() noexcept { ++*count; }
+  static constexpr void on_sleep() noexcept {}
+  static constexpr void on_wake() noexcept {}
+};
+struct sim_flash_timer {
+  static constexpr auto slack = std::chrono::milliseconds(50);
+  int *count;
+  void operator()(auto &q, auto const &tp) const {
+    ++*count;
+    q.que(*this, tp + std::chrono::seconds(1));
+  }
+};
+CTA_TEST(sim_loop_button_sessions, ctx) {
+  using namespace std::chrono;
+  using time_point = sim_clock::time_point;
+  static constexpr auto sleep_timeout = 5min;
+  static constexpr std::uint8_t rise = 0x8;
+  static auto presses = std::array<int, 3>{};
+  static int flashes{};
+  static auto next_sleep = time_point{};
+  static auto edges = spsc_ring<gpio_event, 32>{};
+  static auto debouncer = gpio_debouncer<time_point, 8>(5ms);
+  static auto ui = ui_context::builder()
+                       .gpios(gpio_sel<1> >> sim_press_counter{&presses[0]},
+                              gpio_sel<2> >> sim_press_counter{&presses[1]},
+                              gpio_sel<3> >> sim_press_counter{&presses[2]})
+                       .build();
+  struct dispatch {
+    void operator()(std::uint32_t pins) const {
+      ui.trigger_gpio_mask(
+          pins, [] { next_sleep = sim_clock::now() + sleep_timeout; });
+    }
+  };
+  using confirm_t =
+      debounce_confirm<decltype([]() -> auto & { return debouncer; }),
+                       dispatch>;
+  static auto queue =
+      typed_time_queue(time_point{}, confirm_t{}, sim_flash_timer{&flashes});
+
+  // Sessions of presses, each press bouncing twice, with pauses longer than
+  // the sleep timeout in between.
+  auto rng = std::minstd_rand{};
+  auto script = std::vector<sim_gpio_edge>{};
+  auto expected = std::array<int, 3>{};
+  auto session_ends = std::vector<time_point>{};
+  auto t = time_point(1s);
+  for (int session = 0; session < 20; ++session) {
+    for (int press = 0, n = 1 + static_cast<int>(rng() % 30); press < n;
+         ++press) {
+      auto pin = static_cast<std::uint8_t>(1 + rng() % 3);
+      ++expected[pin - 1u];
+      for (int bounce = 0; bounce < 3; ++bounce) {
+        script.push_back({t, pin, rise});
+        t += microseconds(100 + rng() % 400);
+      }
+      t += milliseconds(100 + rng() % 3000);
+    }
+    session_ends.push_back(script.back().at);
+    t += sleep_timeout + minutes(rng() % 60);
+  }
+
+  sim_clock::set(time_point{});
+  auto platform = sim_loop_platform(script, [](sim_gpio_edge const &e) {
+    push_gpio_edges(edges, std::uint32_t{1} << e.pin, e.edge,
+                    sim_time_us_32());
+  });
+  auto sessions = std::vector<time_point>{};
+  while (platform.sleep_until_event()) {
+    next_sleep = sim_clock::now() + sleep_timeout;
+    queue.que(sim_flash_timer{}, sim_clock::now());
+    run_myb_loop(
+        platform, next_sleep, 1s,
+        [](time_point const &now) {
+          edges.drain([&now](gpio_event const &e) {
+            auto edge_time =
+                now - microseconds(sim_time_us_32() - e.timestamp);
+            queue.que(confirm_t{}, debouncer.edge(e.pin, edge_time));
+          });
+          queue.execute_all(now);
+          return queue.next();
+        },
+        [] { return !edges.empty(); });
+    queue.unque(sim_flash_timer{});
+    sessions.push_back(sim_clock::now());
+  }
+  ctx.expect_that(presses, eq(expected));
+  ctx.expect_that(platform.sleeps(), eq(20u));
+  // The alarm is only ever moved, never cancelled.
+  ctx.expect_that(platform.alarm().cancels(), eq(0u));
+  ctx.expect_that(sessions.size(), eq(session_ends.size()));
+  for (std::size_t i = 0; i < sessions.size(); ++i) {
+    // Asleep within the sleep slack of the timeout after the last press.
+    auto const last_confirm = session_ends[i] + 5ms;
+    ctx.expect_that(sessions[i] >= last_confirm + sleep_timeout - 1s &&
+                        sessions[i] <= last_confirm + sleep_timeout,
+                    eq(true));
+  }
+  // The flasher ran once per second while awake.
+  auto const awake = duration_cast<seconds>(
+      sim_clock::now().time_since_epoch() - platform.sleep_time());
+  ctx.expect_that(std::abs(flashes - static_cast<int>(awake.count())) <= 20,
+                  eq(true));
+}
+CTA_TEST(sim_wake_accounting_report, ctx) {
+  using namespace std::chrono;
+  using time_point = sim_clock::time_point;
+  using namespace std::string_view_literals;
+  static auto stats =
+      wake_accounting<wake_source, wake_source_count, time_point>(
+          wake_source::alarm);
+  static auto edges = spsc_ring<gpio_event, 8>{};
+  auto const script = std::array{sim_gpio_edge{time_point(10ms), 1, 8},
+                                 sim_gpio_edge{time_point(25ms), 1, 8}};
+  sim_clock::set(time_point{});
+  auto platform = sim_loop_platform(script, [](sim_gpio_edge const &e) {
+    stats.note(wake_source::gpio);
+    push_gpio_edges(edges, std::uint32_t{1} << e.pin, e.edge,
+                    sim_time_us_32());
+  });
+  auto const sleep_at = time_point(50ms);
+  // The loop starts on a button press.
+  stats.note(wake_source::gpio);
+  {
+    auto accounted = accounted_loop_platform(platform, stats);
+    // An alarm that is due already does not idle, so it books no wakeup.
+    ctx.expect_that(accounted.idle_until(time_point{}, no_pending_work{}),
+                    eq(false));
+    run_myb_loop(
+        accounted, sleep_at, {},
+        [](time_point const &now) {
+          edges.drain([](gpio_event const &) {});
+          // Every round of tasks takes 100us.
+          sim_clock::set(now + 100us);
+          return std::optional<time_point>{};
+        },
+        [] { return !edges.empty(); });
+  }
+  ctx.expect_that(stats.wakeups(wake_source::gpio), eq(3u));
+  ctx.expect_that(stats.wakeups(wake_source::alarm), eq(1u));
+  ctx.expect_that(stats.awake(wake_source::gpio),
+                  eq(sim_clock::duration(300us)));
+  auto buffer = std::array<char, 64>{};
+  ctx.expect_that(stats.report(buffer, wake_source_names),
+                  eq("alarm 1 0\ngpio 3 300\nwake_rx 0 0\ndma 0 0\n"sv));
+  auto small = std::array<char, 14>{};
+  ctx.expect_that(stats.report(small, wake_source_names),
+                  eq("alarm 1 0\ngpio"sv));
+}
+struct co_pulse_tag {};
+using co_pulse_slot = co_slot<co_pulse_tag>;
+co_task<std::chrono::steady_clock::time_point> co_pulse(co_pulse_slot,
+                                                        int *pin) {
+  using namespace std::chrono_literals;
+  *pin = 1;
+  co_await sleep_for(100us);
+  *pin = 0;
+}
+CTA_TEST(co_task_sleeps_in_time_queue, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto q = typed_time_queue(time_point{}, co_pulse_slot{});
+  int pin{};
+  co_pulse_slot::start(q, co_pulse({}, &pin), time_point(1ms));
+  ctx.expect_that(pin, eq(0));
+  ctx.expect_that(q.execute_all(time_point(2ms)), eq(1));
+  ctx.expect_that(pin, eq(1));
+  // Measured from the deadline, not from when it ran.
+  ctx.expect_that(q.next(), eq(time_point(1100us)));
+  q.execute_all(time_point(2ms));
+  ctx.expect_that(pin, eq(0));
+  ctx.expect_that(co_pulse_slot::running(), eq(false));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+  // The frame is free again, also after a task that never started.
+  { auto unstarted = co_pulse({}, &pin); }
+  co_pulse_slot::start(q, co_pulse({}, &pin), time_point(3ms));
+  q.execute_all(time_point(3ms));
+  ctx.expect_that(pin, eq(1));
+  co_pulse_slot::stop(q);
+  ctx.expect_that(co_pulse_slot::running(), eq(false));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+}
+struct co_lights_tag {};
+using co_lights_slot = co_slot<co_lights_tag>;
+co_task<std::chrono::steady_clock::time_point>
+co_lights(co_lights_slot, dummy_redyelgreen_out *out,
+          std::uint32_t *last_edges) {
+  using namespace std::chrono_literals;
+  auto fsm = traffic_light_fsm();
+  for (;;) {
+    fsm.write_to(*out);
+    *last_edges = co_await next_edges(0b1100);
+    fsm.advance();
+    fsm.write_to(*out);
+    co_await sleep_for(1s);
+    fsm.advance();
+  }
+}
+CTA_TEST(co_task_waits_for_edges, ctx) {
+  using namespace std::chrono;
+  using time_point = steady_clock::time_point;
+  auto q = typed_time_queue(time_point{}, co_pulse_slot{}, co_lights_slot{});
+  auto out = dummy_redyelgreen_out();
+  std::uint32_t edges{};
+  co_lights_slot::start(q, co_lights({}, &out, &edges), time_point{});
+  q.execute_all(time_point{});
+  ctx.expect_that(out.red_on, eq(true));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+  co_lights_slot::notify_edges(q, 0b0011, time_point(1s));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+  co_lights_slot::notify_edges(q, 0b0110, time_point(2s));
+  ctx.expect_that(q.next(), eq(time_point(2s)));
+  q.execute_all(time_point(2s));
+  ctx.expect_that(edges, eq(0b0100u));
+  ctx.expect_that(out.yel_on, eq(true));
+  ctx.expect_that(q.next(), eq(time_point(3s)));
+  // Edges while sleeping are not waited for.
+  co_lights_slot::notify_edges(q, 0b0100, time_point(2500ms));
+  ctx.expect_that(q.next(), eq(time_point(3s)));
+  q.execute_all(time_point(3s));
+  ctx.expect_that(out.gre_on, eq(true));
+  ctx.expect_that(q.next(), eq(std::nullopt));
+  co_lights_slot::stop(q);
+}
+std::vector<std::uint16_t> noisy_adc_samples(std::size_t count) {
+  auto rng = std::minstd_rand{};
+  auto res = std::vector<std::uint16_t>(count);
+  int level = 2000;
+  for (auto &s : res) {
+    level = std::clamp(level + static_cast<int>(rng() % 41) - 20, 100, 3900);
+    s = static_cast<std::uint16_t>(level + static_cast<int>(rng() % 129) - 64);
+  }
+  return res;
+}
+std::vector<std::uint32_t>
+pack_adc_samples(std::span<std::uint16_t const> samples) {
+  auto res = std::vector<std::uint32_t>(samples.size() / 2);
+  for (std::size_t i = 0; i < res.size(); ++i) {
+    res[i] = samples[2 * i] | (std::uint32_t{samples[2 * i + 1]} << 16);
+  }
+  return res;
+}
+// Runs a single stage over the samples and collects its outputs.
+template <typename Stage>
+std::vector<std::int32_t> run_stage(Stage stage,
+                                    std::span<std::uint16_t const> samples) {
+  auto res = std::vector<std::int32_t>{};
+  for (auto s : samples) {
+    stage.push(s, [&res](std::int32_t y) { res.push_back(y); });
+  }
+  return res;
+}
+bool within(std::vector<std::int32_t> const &fixed,
+            std::vector<double> const &reference, double tolerance) {
+  if (fixed.size() != reference.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < fixed.size(); ++i) {
+    if (std::abs(fixed[i] - reference[i]) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+CTA_TEST(sum_packed_samples_matches_fold, ctx) {
+  auto samples = noisy_adc_samples(1024);
+  samples[7] = 4095;
+  std::fill_n(samples.begin() + 100, 64, std::uint16_t{4095});
+  auto packed = pack_adc_samples(samples);
+  for (std::size_t words : {0u, 1u, 16u, 17u, 256u, 512u}) {
+    auto expected = std::accumulate(samples.begin(),
+                                    samples.begin() + 2 * words,
+                                    std::uint32_t{});
+    ctx.expect_that(sum_packed_samples(std::span(packed).first(words)),
+                    eq(expected));
+  }
+}
+CTA_TEST(adc_filters_match_float_reference, ctx) {
+  auto const samples = noisy_adc_samples(2048);
+  auto const x = [&samples](std::size_t i) {
+    return static_cast<double>(samples[i]);
+  };
+  {
+    auto reference = std::vector<double>{};
+    for (std::size_t b = 0; b + 64 <= samples.size(); b += 64) {
+      double sum{};
+      for (std::size_t i = b; i < b + 64; ++i) {
+        sum += x(i);
+      }
+      reference.push_back(sum / 64);
+    }
+    ctx.expect_that(within(run_stage(boxcar<64>{}, samples), reference, 1.),
+                    eq(true));
+  }
+  {
+    auto reference = std::vector<double>{};
+    double y = x(0);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      y += (x(i) - y) / 8;
+      reference.push_back(y);
+    }
+    ctx.expect_that(within(run_stage(ema<3>{}, samples), reference, 2.),
+                    eq(true));
+  }
+  {
+    auto reference = std::vector<double>{};
+    for (std::size_t i = 4; i < samples.size(); ++i) {
+      auto window = std::array<double, 5>{x(i - 4), x(i - 3), x(i - 2),
+                                          x(i - 1), x(i)};
+      std::ranges::sort(window);
+      reference.push_back(window[2]);
+    }
+    ctx.expect_that(within(run_stage(median<5>{}, samples), reference, 0.),
+                    eq(true));
+  }
+  {
+    // Three cascaded moving sums of four, decimated by four.
+    auto stage = std::vector<double>(samples.size());
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      stage[i] = x(i);
+    }
+    for (int order = 0; order < 3; ++order) {
+      auto next = std::vector<double>(samples.size());
+      for (std::size_t i = 0; i < samples.size(); ++i) {
+        for (std::size_t k = 0; k < 4 && k <= i; ++k) {
+          next[i] += stage[i - k];
+        }
+      }
+      stage = std::move(next);
+    }
+    auto reference = std::vector<double>{};
+    for (std::size_t i = 3; i < samples.size(); i += 4) {
+      reference.push_back(stage[i] / 64);
+    }
+    ctx.expect_that(within(run_stage(cic<4, 3>{}, samples), reference, 1.),
+                    eq(true));
+  }
+  {
+    constexpr auto coeffs = std::array<double, 5>{1, 4, 6, 4, 1};
+    auto reference = std::vector<double>{};
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      double acc{};
+      for (std::size_t k = 0; k < coeffs.size() && k <= i; ++k) {
+        acc += coeffs[k] * x(i - k);
+      }
+      reference.push_back(acc / 16);
+    }
+    auto fixed = run_stage(
+        fir<std::array<std::int32_t, 5>{1, 4, 6, 4, 1}, 4>{}, samples);
+    ctx.expect_that(within(fixed, reference, 1.), eq(true));
+  }
+}
+CTA_TEST(adc_pipeline_packed_matches_samples, ctx) {
+  auto const samples = noisy_adc_samples(4096);
+  auto const packed = pack_adc_samples(samples);
+  auto by_sample = adc_pipeline(boxcar<512>{}, ema<2>{});
+  auto by_word = adc_pipeline(boxcar<512>{}, ema<2>{});
+  auto const half = std::span(samples).first(700);
+  ctx.expect_that(by_sample.run(half).has_value(), eq(true));
+  ctx.expect_that(by_word.run(std::span(packed).first(350)).has_value(),
+                  eq(true));
+  ctx.expect_that(by_word.value(), eq(by_sample.value()));
+  by_sample.run(std::span(samples).subspan(700));
+  by_word.run(std::span(packed).subspan(350));
+  ctx.expect_that(by_word.outputs(), eq(8u));
+  ctx.expect_that(by_word.outputs(), eq(by_sample.outputs()));
+  ctx.expect_that(by_word.value(), eq(by_sample.value()));
+  // Not enough samples for a new output.
+  ctx.expect_that(by_word.run(std::span(packed).first(100)), eq(std::nullopt));
+}
+CTA_TEST(adc_dma_sniffer_matches_cpu, ctx) {
+  auto const samples = noisy_adc_samples(4096);
+  auto cpu = adc_dma_capture<sim_adc_dma, 512>(sim_adc_dma(samples));
+  auto sniffer = adc_dma_capture<sim_adc_dma, 512, adc_averaging::sniffer>(
+      sim_adc_dma(samples));
+  auto cpu_filter = adc_pipeline(boxcar<512>{}, ema<2>{});
+  auto sniffer_filter = adc_pipeline(ema<2>{});
+  cpu.start();
+  sniffer.start();
+  for (int block = 0; block < 20; ++block) {
+    cpu.hal().complete();
+    sniffer.hal().complete();
+    auto const expected = cpu.take(cpu_filter);
+    ctx.expect_that(expected.has_value(), eq(true));
+    ctx.expect_that(sniffer.take(sniffer_filter), eq(expected));
+  }
+  ctx.expect_that(sniffer.hal().acks(), eq(20u));
+  ctx.expect_that(sniffer_filter.outputs(), eq(20u));
+}
+std::int32_t block_mean(std::span<std::uint16_t const> samples,
+                        std::size_t block, std::size_t size) {
+  auto const first =
+      samples.begin() + static_cast<std::ptrdiff_t>(block * size);
+  return static_cast<std::int32_t>(
+      std::accumulate(first, first + static_cast<std::ptrdiff_t>(size),
+                      std::uint32_t{}) /
+      size);
+}
+CTA_TEST(adc_chained_capture_ping_pong, ctx) {
+  auto const samples = noisy_adc_samples(512 * 16);
+  auto capture = adc_chained_capture<sim_chained_adc_dma, 512>(
+      sim_chained_adc_dma(samples));
+  auto filter = adc_pipeline(boxcar<512>{});
+  capture.start();
+  for (std::size_t block = 0; block < 4; ++block) {
+    ctx.expect_that(capture.take(filter), eq(std::nullopt));
+    capture.hal().convert(512);
+    ctx.expect_that(capture.take(filter),
+                    eq(block_mean(samples, block, 512)));
+  }
+  // Two blocks before the interrupt runs: both are dropped and the chain is
+  // restarted on the next block.
+  capture.hal().convert(1024);
+  ctx.expect_that(capture.take(filter), eq(std::nullopt));
+  ctx.expect_that(capture.overruns(), eq(1u));
+  ctx.expect_that(capture.dropped_samples(), eq(1024u));
+  capture.hal().convert(512);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 6, 512)));
+  capture.hal().convert(512);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 7, 512)));
+  // The ADC runs on past both halves before the interrupt: the chained
+  // channel starts its half over instead of writing past it.
+  capture.hal().convert(1024 + 100);
+  ctx.expect_that(capture.hal().stray_writes(), eq(0u));
+  ctx.expect_that(capture.take(filter), eq(std::nullopt));
+  ctx.expect_that(capture.overruns(), eq(2u));
+  capture.hal().convert(512);
+  ctx.expect_that(capture.take(filter),
+                  eq(block_mean(std::span(samples).subspan(100), 10, 512)));
+  ctx.expect_that(capture.fifo_overflows(), eq(0u));
+  ctx.expect_that(capture.hal().overflowed_samples(), eq(0u));
+  ctx.expect_that(capture.hal().stray_writes(), eq(0u));
+}
+CTA_TEST(adc_chained_capture_ring, ctx) {
+  auto const samples = noisy_adc_samples(512 * 16);
+  auto capture =
+      adc_chained_capture<sim_chained_adc_dma, 512, adc_chaining::ring>(
+          sim_chained_adc_dma(samples));
+  auto filter = adc_pipeline(boxcar<512>{});
+  capture.start();
+  for (std::size_t block = 0; block < 3; ++block) {
+    capture.hal().convert(512);
+    ctx.expect_that(capture.take(filter),
+                    eq(block_mean(samples, block, 512)));
+  }
+  // The interrupt runs after block 4 has started to overwrite block 3.
+  capture.hal().convert(512 + 100);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 3, 512)));
+  capture.hal().convert(412);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 4, 512)));
+  ctx.expect_that(capture.overruns(), eq(0u));
+  capture.hal().convert(2 * 512 + 100);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 6, 512)));
+  ctx.expect_that(capture.overruns(), eq(1u));
+  ctx.expect_that(capture.dropped_samples(), eq(512u));
+  capture.hal().convert(412);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 7, 512)));
+  // Blocks 8 and 9 complete in one interrupt, and the DMA sits exactly at
+  // the start of block 8's half again.
+  capture.hal().convert(2 * 512);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 9, 512)));
+  ctx.expect_that(capture.overruns(), eq(2u));
+  capture.hal().convert(512);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 10, 512)));
+  capture.hal().convert(512 + 5);
+  ctx.expect_that(capture.take(filter), eq(block_mean(samples, 11, 512)));
+  ctx.expect_that(capture.overruns(), eq(2u));
+  ctx.expect_that(capture.fifo_overflows(), eq(0u));
+  ctx.expect_that(capture.hal().stray_writes(), eq(0u));
+}
+CTA_TEST(adc_channels_deinterleave_round_robin, ctx) {
+  using channels_t = adc_channel_list<0, 2, 4>;
+  static_assert(channels_t::round_robin_mask == 0b10101u);
+  static_assert(channels_t::index_of<4> == 2);
+  constexpr std::size_t per_channel = 64;
+  // Both inputs ramp within each block, the temperature sensor reads a
+  // constant.
+  auto stream = std::vector<std::uint16_t>{};
+  for (std::size_t block = 0; block < 4; ++block) {
+    for (std::size_t k = 0; k < per_channel; ++k) {
+      stream.push_back(static_cast<std::uint16_t>(block * 100 + k));
+      stream.push_back(static_cast<std::uint16_t>(1000 + block * 100 + k));
+      stream.push_back(876);
+    }
+  }
+  auto const packed = pack_adc_samples(stream);
+  auto split = std::array<std::array<std::uint32_t, per_channel / 2>, 3>{};
+  deinterleave_packed<3, per_channel / 2>(
+      std::span(packed).first<3 * per_channel / 2>(), split);
+  ctx.expect_that(split[0][0], eq(0u | (1u << 16)));
+  ctx.expect_that(split[1][31], eq(1062u | (1063u << 16)));
+  ctx.expect_that(split[2][5], eq(876u | (876u << 16)));
+
+  auto capture =
+      adc_chained_capture<sim_chained_adc_dma, 3 * per_channel>(
+          sim_chained_adc_dma(stream));
+  auto channels = adc_channels<channels_t, per_channel,
+                               adc_pipeline<boxcar<per_channel>>>(
+      adc_pipeline(boxcar<per_channel>{}));
+  capture.start();
+  for (std::int32_t block = 0; block < 4; ++block) {
+    capture.hal().convert(3 * per_channel);
+    // The mean of k over a block is 31.5.
+    ctx.expect_that(capture.take(channels),
+                    eq(std::array<std::int32_t, 3>{block * 100 + 31,
+                                                   1031 + block * 100, 876}));
+  }
+  auto const celsius =
+      adc_temperature_millicelsius(channels.channel<4>().value()) / 1000;
+  ctx.expect_that(celsius, eq(27));
+}
+// One filtered ADC value per millisecond, as dma_irq sees them.
+struct adc_trace_replay {
+  std::uint32_t updates{};
+  std::uint32_t activities{};
+  std::uint32_t old_rule_wakes{};
+};
+template <typename Trace>
+adc_trace_replay replay_adc_trace(
+    adc_change_detector<std::chrono::steady_clock::time_point> &detector,
+    Trace &&trace) {
+  using namespace std::chrono;
+  auto res = adc_trace_replay{};
+  auto old_value = std::int32_t{};
+  auto tp = steady_clock::time_point{};
+  for (std::int32_t v : trace) {
+    tp += 1ms;
+    auto const change = detector.push(v, tp);
+    res.updates += change.update;
+    res.activities += change.activity;
+    // The rule dma_irq had before.
+    if (static_cast<unsigned>(v - old_value) >= 32) {
+      ++res.old_rule_wakes;
+      old_value = v;
+    }
+  }
+  return res;
+}
+CTA_TEST(adc_change_detector_replays_traces, ctx) {
+  using namespace std::chrono;
+  auto rng = std::minstd_rand{};
+  auto noise = [&rng] { return static_cast<std::int32_t>(rng() % 41) - 20; };
+  auto make_detector = [] {
+    return adc_change_detector<steady_clock::time_point>(16, 16, 20ms, 50ms);
+  };
+  // A knob left alone: noise and a slow downward drift.
+  auto idle = std::vector<std::int32_t>{};
+  for (int i = 0; i < 10'000; ++i) {
+    idle.push_back(2000 - i / 200 + noise());
+  }
+  auto detector = make_detector();
+  auto idle_run = replay_adc_trace(detector, idle);
+  ctx.expect_that(idle_run.activities, eq(0u));
+  ctx.expect_that(idle_run.old_rule_wakes > 1000, eq(true));
+  ctx.expect_that(detector.suppressed() > 0, eq(true));
+  ctx.expect_that(std::abs(detector.output() - idle.back()) <= 16 + 20,
+                  eq(true));
+
+  // A single glitch postpones nothing.
+  auto glitch = std::vector<std::int32_t>(100, 2000);
+  glitch[50] = 2600;
+  detector = make_detector();
+  auto glitch_run = replay_adc_trace(detector, glitch);
+  ctx.expect_that(glitch_run.activities, eq(0u));
+  ctx.expect_that(detector.output(), eq(2000));
+
+  // The knob turned from 1000 to 3000 over 200ms.
+  auto turn = std::vector<std::int32_t>(100, 1000);
+  for (int i = 0; i < 200; ++i) {
+    turn.push_back(1000 + 10 * i + noise());
+  }
+  turn.insert(turn.end(), 200, 3000);
+  detector = make_detector();
+  auto turn_run = replay_adc_trace(detector, turn);
+  ctx.expect_that(turn_run.activities > 0, eq(true));
+  ctx.expect_that(detector.activities(), eq(turn_run.activities));
+  ctx.expect_that(turn_run.updates > 50, eq(true));
+  ctx.expect_that(std::abs(detector.output() - 3000) <= 16, eq(true));
+
+  // A slow turn, half a step per value, is still more than drift.
+  auto slow_turn = std::vector<std::int32_t>(100, 2000);
+  for (int i = 0; i < 2000; ++i) {
+    slow_turn.push_back(2000 + i / 2);
+  }
+  detector = make_detector();
+  ctx.expect_that(replay_adc_trace(detector, slow_turn).activities > 0,
+                  eq(true));
+
+  // Out of the band for just under the dwell time. Back in it, the anchor
+  // must not catch up on the drift steps of that time, or a small move
+  // back would count as activity.
+  auto bump = std::vector<std::int32_t>(100, 2000);
+  bump.insert(bump.end(), 190, 2600);
+  bump.push_back(2030);
+  bump.insert(bump.end(), 300, 1985);
+  auto slow_dwell =
+      adc_change_detector<steady_clock::time_point>(16, 16, 200ms, 10ms);
+  ctx.expect_that(replay_adc_trace(slow_dwell, bump).activities, eq(0u));
+}
+CTA_TEST(adc_rate_controller_bursts_on_movement, ctx) {
+  using namespace std::chrono;
+  using tp_t = steady_clock::time_point;
+  auto rate = adc_rate_controller<tp_t>(500ms);
+  auto const still = adc_change{};
+  auto const moved = adc_change{.update = true};
+  auto tp = tp_t{};
+  ctx.expect_that(rate.push(moved, tp).has_value(), eq(false));
+  ctx.expect_that(rate.push(still, tp + 499ms).has_value(), eq(false));
+  ctx.expect_that(rate.push(still, tp + 500ms), eq(adc_rate::background));
+  ctx.expect_that(rate.push(still, tp + 600ms).has_value(), eq(false));
+  ctx.expect_that(rate.push(moved, tp + 700ms), eq(adc_rate::burst));
+  ctx.expect_that(rate.push(moved, tp + 1s).has_value(), eq(false));
+  ctx.expect_that(rate.push(still, tp + 1400ms).has_value(), eq(false));
+  ctx.expect_that(rate.push(still, tp + 1500ms), eq(adc_rate::background));
+  ctx.expect_that(rate.bursts(), eq(1u));
+  ctx.expect_that(adc_clkdiv(adc_max_rate), eq(0.f));
+  ctx.expect_that(adc_clkdiv(8'000), eq(5999.f));
+}
+CTA_TEST(per_second_counter_counts_whole_seconds, ctx) {
+  using namespace std::chrono;
+  using tp_t = steady_clock::time_point;
+  auto counter = per_second_counter<tp_t>{};
+  auto tp = tp_t{} + 250ms;
+  for (int i = 0; i < 100; ++i) {
+    counter.note(tp + i * 10ms);
+  }
+  ctx.expect_that(counter.per_second(), eq(0u));
+  counter.note(tp + 1s);
+  ctx.expect_that(counter.per_second(), eq(100u));
+  counter.note(tp + 1500ms);
+  counter.advance(tp + 2s);
+  ctx.expect_that(counter.per_second(), eq(2u));
+  counter.advance(tp + 5s);
+  ctx.expect_that(counter.per_second(), eq(0u));
+  ctx.expect_that(counter.peak(), eq(100u));
+}
+// CIE 1931 luminance of lightness l, 0 to 100.
+double cie_reference(double l) {
+  return l <= 8. ? l / 903.3 : std::pow((l + 16.) / 116., 3.);
+}
+CTA_TEST(cie_lut_matches_reference_curve, ctx) {
+  constexpr auto lut = cie_lut<led_lightness_steps, 256>();
+  static_assert(lut.front() == 0 && lut.back() == 256);
+  auto max_error = 0.;
+  for (std::size_t i = 0; i < lut.size(); ++i) {
+    auto const l = 100. * static_cast<double>(i) / 255.;
+    max_error = std::max(max_error, std::abs(lut[i] - cie_reference(l) * 256.));
+  }
+  ctx.expect_that(max_error <= .5, eq(true));
+  ctx.expect_that(std::ranges::is_sorted(lut), eq(true));
+}
+struct led_frame {
+  std::size_t channel;
+  std::uint16_t level;
+  std::chrono::steady_clock::time_point at;
+};
+static auto led_frames = std::vector<led_frame>{};
+struct led_frame_out {
+  void operator()(std::size_t channel, std::uint16_t level) const {
+    led_frames.push_back({channel, level, {}});
+  }
+};
+inline constexpr auto test_led_lut = cie_lut<led_lightness_steps, 256>();
+static auto test_leds = led_animator<std::chrono::steady_clock::time_point, 3,
+                                     led_frame_out>(
+    test_led_lut, std::chrono::milliseconds(20));
+using test_led_step =
+    led_animation_step<decltype([]() -> auto & { return test_leds; })>;
+CTA_TEST(led_animator_frames_follow_patterns, ctx) {
+  using namespace std::chrono;
+  using tp_t = steady_clock::time_point;
+  auto q = typed_time_queue(tp_t{}, test_led_step{});
+  auto run_until = [&q](tp_t end) {
+    while (auto n = q.next()) {
+      if (*n > end) {
+        break;
+      }
+      auto const first = led_frames.size();
+      q.execute_all(*n);
+      for (auto i = first; i < led_frames.size(); ++i) {
+        led_frames[i].at = *n;
+      }
+    }
+  };
+  auto const start = tp_t{} + 1s;
+  test_leds.fade(0, 255, 500ms, start);
+  test_leds.breathe(1, 0, 200, 1s, start);
+  test_leds.blink(2, 255, 100ms, 300ms, start);
+  q.que(test_led_step{}, start);
+  run_until(start + 1s);
+
+  auto steps = std::array<std::size_t, 3>{};
+  for (auto const &f : led_frames) {
+    auto const t = duration<double>(f.at - start).count();
+    ++steps[f.channel];
+    if (f.channel == 0) {
+      // Linear in lightness, from 0 to full over half a second.
+      auto const l = 100. * std::min(t / .5, 1.);
+      ctx.expect_that(std::abs(f.level - cie_reference(l) * 256.) <= 3.,
+                      eq(true));
+    } else if (f.channel == 1) {
+      auto const phase = std::fmod(t, 1.);
+      auto const l = 200. / 255. * 100. * 2 * std::min(phase, 1. - phase);
+      ctx.expect_that(std::abs(f.level - cie_reference(l) * 256.) <= 3.,
+                      eq(true));
+    } else {
+      auto const on = (f.at - start) % 300ms < 100ms;
+      ctx.expect_that(f.level, eq(on ? 256 : 0));
+    }
+  }
+  // A frame per 20ms tick at most, and the blink only on its edges.
+  ctx.expect_that(steps[0], eq(26u));
+  ctx.expect_that(steps[1] <= 51, eq(true));
+  ctx.expect_that(steps[2], eq(8u));
+  ctx.expect_that(test_leds.steps() <= 51, eq(true));
+
+  // With only steady channels left the step is no longer queued.
+  test_leds.set(1, 10);
+  test_leds.set(2, 0);
+  run_until(start + 2s);
+  ctx.expect_that(q.next().has_value(), eq(false));
+  ctx.expect_that(led_frames.back().level, eq(test_led_lut[10]));
+}
+CTA_TEST(pwm_dma_player_writes_sequences, ctx) {
+  ctx.expect_that(pwm_cc_word(0, 0x12, 0x34), eq(0x340012u));
+  ctx.expect_that(pwm_cc_word(1, 0x12, 0x34), eq(0x120034u));
+
+  // A fade from dark to full over 190 wraps, on channel B of the slice.
+  auto fade = std::array<std::uint32_t, 190>{};
+  pwm_fade_words(fade, test_led_lut, 0, 255, 1, 7);
+  auto player = pwm_dma_player<sim_pwm_dma>{};
+  player.play(fade);
+  auto ok = true;
+  for (std::size_t i = 0; i < fade.size(); ++i) {
+    auto const cc = player.hal().wrap();
+    auto const lightness = 255 * (i + 1) / fade.size();
+    ok = ok && cc == (std::uint32_t{test_led_lut[lightness]} << 16 | 7);
+  }
+  ctx.expect_that(ok, eq(true));
+  ctx.expect_that(player.playing(), eq(false));
+  ctx.expect_that(player.hal().wrap() >> 16, eq(256u));
+  ctx.expect_that(player.hal().writes(), eq(190u));
+
+  // A looped sine, 256 words per period, on channel A.
+  alignas(1024) static constexpr auto sine = pwm_sine_words<256>(255, 0);
+  auto max_error = 0.;
+  for (std::size_t i = 0; i < sine.size(); ++i) {
+    auto const expected =
+        (1. + std::sin(2. * std::numbers::pi * i / 256.)) / 2. * 255.;
+    max_error = std::max(max_error, std::abs(sine[i] - expected));
+  }
+  ctx.expect_that(max_error <= .5, eq(true));
+  player.loop(sine);
+  for (std::size_t i = 0; i < 600; ++i) {
+    ok = ok && player.hal().wrap() == sine[i % sine.size()];
+  }
+  ctx.expect_that(ok, eq(true));
+  ctx.expect_that(player.playing(), eq(true));
+  ctx.expect_that(player.position(), eq(600u % 256u));
+  player.stop();
+  auto const stopped_at = player.hal().cc();
+  player.hal().wrap();
+  ctx.expect_that(player.hal().cc(), eq(stopped_at));
+  ctx.expect_that(player.hal().writes(), eq(790u));
+}
+template <typename Scatter, std::size_t n>
+bool scatters_like_pins(std::array<int, n> const &pins) {
+  for (std::uint32_t v = 0; v < (1u << n); ++v) {
+    std::uint32_t expected{};
+    for (std::size_t i = 0; i < n; ++i) {
+      expected |= ((v >> i) & 1u) << pins[i];
+    }
+    if (Scatter::scatter(v) != expected ||
+        Scatter::scatter(std::bitset<n>(v)) != expected) {
+      return false;
+    }
+  }
+  return true;
+}
+CTA_TEST(gpio_bit_scatter_maps_bits_to_pins, ctx) {
+  using result_pins = gpio_bit_scatter<20, 21, 22, 26, 27, 28>;
+  static_assert(result_pins::mask == 0x1c700000u);
+  static_assert(result_pins::scatter(0b101'011) == 0x14300000u);
+  ctx.expect_that(result_pins::runs, eq(2u));
+  ctx.expect_that(scatters_like_pins<result_pins>(
+                      std::array{20, 21, 22, 26, 27, 28}),
+                  eq(true));
+  using shuffled_pins = gpio_bit_scatter<9, 8, 0, 1, 31>;
+  ctx.expect_that(shuffled_pins::runs, eq(4u));
+  ctx.expect_that(scatters_like_pins<shuffled_pins>(std::array{9, 8, 0, 1, 31}),
+                  eq(true));
+}
 CTA_TEST(traffic_light_basics, ctx) {
   auto out = dummy_redyelgreen_out();
   auto to_test = traffic_light_fsm();